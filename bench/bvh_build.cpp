@@ -0,0 +1,72 @@
+// Build time of the BVH builders on random geometry: the flattened BVH of an
+// indexed triangle mesh and the pointer BVH (plus wide collapse) the
+// top-level structure uses over separate sphere objects. The SAH cost and
+// node count are printed as well, so runs at different thread counts
+// (OMP_NUM_THREADS) can be checked for identical trees.
+//
+// Usage: bvh_build [triangles] [spheres]
+#include "triangle_mesh.h"
+#include "instance.h"
+#include "sphere.h"
+#include "pcg32.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Small triangles scattered through a unit cube.
+mesh_buffers random_triangles(size_t count, pcg32& rng) {
+    mesh_buffers buffers;
+    for (size_t t = 0; t < count; ++t) {
+        const double cx = rng.next_double(), cy = rng.next_double(), cz = rng.next_double();
+        for (int k = 0; k < 3; ++k) {
+            buffers.px.push_back(static_cast<float>(cx + 0.01 * rng.next_double()));
+            buffers.py.push_back(static_cast<float>(cy + 0.01 * rng.next_double()));
+            buffers.pz.push_back(static_cast<float>(cz + 0.01 * rng.next_double()));
+            buffers.indices.push_back(static_cast<uint32_t>(3 * t + k));
+        }
+    }
+    return buffers;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t triangles = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+    const size_t spheres = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+#ifdef _OPENMP
+    std::cout << "Threads: " << omp_get_max_threads() << "\n";
+#endif
+
+    pcg32 rng(7, 1);
+    mesh_buffers buffers = random_triangles(triangles, rng);
+    auto start = std::chrono::steady_clock::now();
+    triangle_mesh mesh(std::move(buffers), nullptr);
+    std::cout << "triangle_mesh, " << triangles << " triangles: " << seconds_since(start) << " s, "
+              << mesh.arrays().node_count << " nodes\n";
+
+    hittable_list list;
+    for (size_t i = 0; i < spheres; ++i) {
+        const point3 center(rng.next_double(), rng.next_double(), rng.next_double());
+        list.add(std::make_shared<sphere>(center, 0.002, nullptr));
+    }
+    start = std::chrono::steady_clock::now();
+    bvh_node tree(list);
+    const double tree_seconds = seconds_since(start);
+    std::cout << "bvh_node, " << spheres << " spheres: " << tree_seconds << " s, SAH cost " << tree.sah_cost() << "\n";
+
+    start = std::chrono::steady_clock::now();
+    tlas accel(list);
+    std::cout << "tlas (build + wide collapse): " << seconds_since(start) << " s, "
+              << accel.accelerator().node_count() << " wide nodes\n";
+}
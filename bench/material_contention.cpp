@@ -0,0 +1,77 @@
+// Measures what recording a hit costs when every thread hits the same
+// material: copying a shared_ptr<material> (one atomic increment and decrement
+// on a shared control block per hit, as hit_record used to do) against the
+// plain pointer hit_record holds now.
+//
+// Usage: material_contention [max_threads] [hits_per_thread]
+#include "sphere.h"
+#include "lambertian.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct legacy_hit_record {
+    hit_record rec;
+    std::shared_ptr<material> mat_owner;
+};
+
+std::atomic<uint64_t> sink(0);
+
+template <bool SharedOwner>
+double run(int threads, long hits, const sphere& target, const std::shared_ptr<material>& owner) {
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> pool;
+
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t]() {
+            ray r(point3(0.001 * t, 0, 5), vec3(0, 0, -1));
+            legacy_hit_record out;
+            uint64_t found = 0;
+            ready++;
+            while (!go.load()) std::this_thread::yield();
+            for (long i = 0; i < hits; ++i) {
+                if (target.hit(r, 0.001, infinity, out.rec)) {
+                    if (SharedOwner) out.mat_owner = owner;
+                    found += out.rec.mat_ptr != nullptr;
+                }
+                if (SharedOwner) out.mat_owner.reset();
+            }
+            sink += found;
+        });
+    }
+    while (ready.load() < threads) std::this_thread::yield();
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& th : pool) th.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(hits) * threads / seconds;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const int hw = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const int max_threads = argc > 1 ? std::atoi(argv[1]) : std::max(32, hw);
+    const long hits = argc > 2 ? std::atol(argv[2]) : 2000000;
+
+    material_table materials;
+    auto owner = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    const sphere target(point3(0, 0, 0), 1.0, materials.add(owner));
+
+    std::cout << "hardware threads: " << hw << ", hits per thread: " << hits << "\n";
+    std::cout << "threads  shared_ptr Mhits/s  raw pointer Mhits/s  speedup\n";
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double shared = run<true>(threads, hits, target, owner);
+        double raw = run<false>(threads, hits, target, owner);
+        std::cout << threads << "  " << shared * 1e-6 << "  " << raw * 1e-6 << "  " << raw / shared << "\n";
+    }
+    return sink.load() == 0;
+}
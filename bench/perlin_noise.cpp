@@ -0,0 +1,59 @@
+// Throughput of the Perlin noise kernels on random points, through the batch
+// API and through turb(), with the largest difference from the scalar
+// kernel. Every kernel gets the same gradient and permutation tables.
+//
+// Usage: perlin_noise [points]
+#include "perlin.h"
+#include "pcg32.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+
+    pcg32 rng(11, 3);
+    std::vector<point3> points(count);
+    for (auto& p : points)
+        p = point3(40 * rng.next_double() - 20, 40 * rng.next_double() - 20, 40 * rng.next_double() - 20);
+
+    std::vector<double> reference, turb_reference;
+    for (simd_kernel kernel : { simd_kernel::scalar, simd_kernel::sse, simd_kernel::avx2 }) {
+        thread_rng().seed(5, 1);
+        const perlin noise(kernel);
+        if (noise.kernel() != kernel)
+            continue;   // not supported here
+
+        std::vector<double> values(count), turbs(count);
+        auto start = std::chrono::steady_clock::now();
+        noise.noise(points.data(), values.data(), count);
+        const double noise_seconds = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+            turbs[i] = noise.turb(points[i]);
+        const double turb_seconds = seconds_since(start);
+
+        if (reference.empty()) {
+            reference = values;
+            turb_reference = turbs;
+        }
+        double max_error = 0;
+        for (size_t i = 0; i < count; ++i) {
+            max_error = std::fmax(max_error, std::fabs(values[i] - reference[i]));
+            max_error = std::fmax(max_error, std::fabs(turbs[i] - turb_reference[i]));
+        }
+        std::cout << noise.kernel_name() << ": noise " << count / noise_seconds * 1e-6 << " M points/s, turb "
+                  << count / turb_seconds * 1e-6 << " M points/s, max difference from scalar " << max_error << "\n";
+    }
+}
@@ -0,0 +1,95 @@
+// Closest-hit and shadow-ray throughput of primitive_arrays, which keeps
+// spheres and triangles in typed arrays and dispatches leaves with a switch,
+// against linear_bvh over the same objects through the virtual interface.
+// Both build the same flattened BVH, so the difference is the leaf calls.
+// Hit counts are printed as well and must match, and so must the object
+// each hit reports, which light sampling looks up.
+//
+// Usage: primitive_dispatch [spheres] [triangles] [rays]
+#include "primitive_arrays.h"
+#include "linear_bvh.h"
+#include "lambertian.h"
+#include "pcg32.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const int sphere_count = argc > 1 ? std::atoi(argv[1]) : 50000;
+    const int triangle_count = argc > 2 ? std::atoi(argv[2]) : 50000;
+    const int ray_count = argc > 3 ? std::atoi(argv[3]) : 200000;
+
+    // Random geometry in the unit cube.
+    pcg32 rng(7, 1);
+    auto random_point = [&]() { return point3(rng.next_double(), rng.next_double(), rng.next_double()); };
+    auto random_offset = [&]() { return 0.01 * (vec3(rng.next_double(), rng.next_double(), rng.next_double()) - vec3(0.5, 0.5, 0.5)); };
+    const lambertian mat(color(0.5, 0.5, 0.5));
+    hittable_list world;
+    for (int i = 0; i < sphere_count; ++i)
+        world.add(std::make_shared<sphere>(random_point(), 0.002, &mat));
+    for (int i = 0; i < triangle_count; ++i) {
+        const point3 a = random_point();
+        world.add(std::make_shared<triangle>(a, a + random_offset(), a + random_offset(), &mat));
+    }
+
+    // Rays from points outside the cube toward points inside it.
+    std::vector<ray> rays;
+    rays.reserve(ray_count);
+    for (int i = 0; i < ray_count; ++i) {
+        const point3 from = 3.0 * random_point() - vec3(1, 1, 1);
+        rays.push_back(ray(from, random_point() - from));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    const linear_bvh bvh(world);
+    std::cout << "linear_bvh build: " << seconds_since(start) << " s, " << bvh.node_count() << " nodes\n";
+    start = std::chrono::steady_clock::now();
+    const primitive_arrays arrays(world);
+    std::cout << "primitive_arrays build: " << seconds_since(start) << " s, " << arrays.node_count() << " nodes\n";
+
+    auto report = [&](const char* name, const hittable& h) {
+        long hits = 0, blocked = 0;
+        double t_sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const ray& r : rays) {
+            hit_record rec;
+            if (h.hit(r, 0.001, infinity, rec)) {
+                ++hits;
+                t_sum += rec.t;
+            }
+        }
+        const double hit_seconds = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+        for (const ray& r : rays) {
+            if (h.occluded(r, 0.001, 1.0))
+                ++blocked;
+        }
+        const double occluded_seconds = seconds_since(start);
+        std::cout << name << ": hit " << rays.size() / hit_seconds * 1e-6 << " M rays/s, occluded "
+                  << rays.size() / occluded_seconds * 1e-6 << " M rays/s, " << hits << " hits (mean t "
+                  << (hits ? t_sum / hits : 0.0) << "), " << blocked << " blocked\n";
+    };
+
+    report("linear_bvh", bvh);
+    report("primitive_arrays", arrays);
+
+    long different_objects = 0;
+    for (const ray& r : rays) {
+        hit_record a, b;
+        const bool hit_a = bvh.hit(r, 0.001, infinity, a), hit_b = arrays.hit(r, 0.001, infinity, b);
+        if (hit_a != hit_b || (hit_a && a.object != b.object))
+            ++different_objects;
+    }
+    std::cout << different_objects << " rays hit a different object\n";
+    return different_objects != 0;
+}
@@ -0,0 +1,121 @@
+// Convergence of the pixel samplers: renders a small test scene at 1, 2, 4,
+// ... samples per pixel with each sampler and reports the RMSE (on the
+// gamma-corrected image) against a high sample count reference.
+//
+// Usage: sampler_convergence [width] [max_spp] [reference_spp]
+#include "integrator.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "lambertian.h"
+#include "metal.h"
+#include "dielectric.h"
+#include "emissive.h"
+#include "checker_texture.h"
+#include "color.h"
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+struct test_scene {
+    material_table materials;
+    hittable_list world;
+    light_list lights;
+};
+
+void build_scene(test_scene& scene) {
+    auto checker = std::make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
+    auto ground = scene.materials.add(std::make_shared<lambertian>(checker));
+    auto diffuse = scene.materials.add(std::make_shared<lambertian>(color(0.1, 0.2, 0.5)));
+    auto glass = scene.materials.add(std::make_shared<dielectric>(1.5));
+    auto brushed = scene.materials.add(std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.3));
+    auto light = scene.materials.add(std::make_shared<emissive>(color(8, 8, 8)));
+
+    scene.world.add(std::make_shared<sphere>(point3(0, -100.5, -1), 100, ground));
+    scene.world.add(std::make_shared<sphere>(point3(0, 0, -1), 0.5, diffuse));
+    scene.world.add(std::make_shared<sphere>(point3(-1, 0, -1), 0.5, glass));
+    scene.world.add(std::make_shared<sphere>(point3(1, 0, -1), 0.5, brushed));
+    scene.world.add(std::make_shared<sphere>(point3(0, 3, -1), 0.5, light));
+    scene.lights = light_list(scene.world);
+}
+
+std::vector<color> render(const test_scene& scene, const camera& cam, int width, int height,
+                          sampler_type type, int spp, uint64_t seed) {
+    std::vector<color> image(static_cast<size_t>(width) * height);
+    const auto prototype = make_sampler(type, spp, seed);
+
+    #pragma omp parallel
+    {
+        auto samp = prototype->clone();
+        path_stats stats;
+        #pragma omp for schedule(dynamic)
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                color sum(0, 0, 0);
+                for (int s = 0; s < spp; ++s) {
+                    samp->start_pixel_sample(i, j, s);
+                    vec2 jitter = samp->get_2d();
+                    ray r = cam.get_ray((i + jitter.x()) / (width - 1), (j + jitter.y()) / (height - 1), *samp);
+                    sum += ray_color(r, scene.world, scene.lights, 50, 3, *samp, stats);
+                }
+                image[static_cast<size_t>(j) * width + i] = sum / spp;
+            }
+        }
+    }
+    return image;
+}
+
+double rmse(const std::vector<color>& a, const std::vector<color>& b) {
+    double sum = 0;
+    for (size_t p = 0; p < a.size(); ++p) {
+        for (int c = 0; c < 3; ++c) {
+            double d = (to_byte(a[p][c]) - to_byte(b[p][c])) / 255.0;
+            sum += d * d;
+        }
+    }
+    return std::sqrt(sum / (3.0 * a.size()));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const int width = argc > 1 ? std::atoi(argv[1]) : 64;
+    const int max_spp = argc > 2 ? std::atoi(argv[2]) : 64;
+    const int reference_spp = argc > 3 ? std::atoi(argv[3]) : 4096;
+    const double aspect_ratio = 16.0 / 9.0;
+    const int height = static_cast<int>(width / aspect_ratio);
+
+    test_scene scene;
+    build_scene(scene);
+    point3 lookfrom(3, 3, 2), lookat(0, 0, -1);
+    camera cam(lookfrom, lookat, vec3(0, 1, 0), 40.0, aspect_ratio, 0.05, (lookfrom - lookat).length());
+
+    std::cerr << "Rendering " << width << "x" << height << " reference at " << reference_spp << " spp\n";
+    const auto reference = render(scene, cam, width, height, sampler_type::sobol, reference_spp, 0xfeed);
+
+    const sampler_type types[] = { sampler_type::independent, sampler_type::stratified,
+                                   sampler_type::sobol, sampler_type::blue_noise };
+    std::cout << "spp";
+    for (auto type : types)
+        std::cout << "  " << make_sampler(type, 1)->name();
+    std::cout << "  independent/sobol (RMSE)\n";
+
+    for (int spp = 1; spp <= max_spp; spp *= 2) {
+        std::cout << spp;
+        double independent_error = 0, sobol_error = 0;
+        for (auto type : types) {
+            double error = rmse(render(scene, cam, width, height, type, spp, 1), reference);
+            if (type == sampler_type::independent) independent_error = error;
+            if (type == sampler_type::sobol) sobol_error = error;
+            std::cout << "  " << error;
+        }
+        std::cout << "  " << independent_error / sobol_error << "\n";
+    }
+    return 0;
+}
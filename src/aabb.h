@@ -28,6 +28,21 @@ public:
         return true;
     }
 
+    double surface_area() const {
+        vec3 d = maximum - minimum;
+        return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    point3 centroid() const {
+        return 0.5 * (minimum + maximum);
+    }
+
+    int longest_axis() const {
+        vec3 d = maximum - minimum;
+        if (d.x() > d.y() && d.x() > d.z()) return 0;
+        return d.y() > d.z() ? 1 : 2;
+    }
+
     point3 minimum;
     point3 maximum;
 };
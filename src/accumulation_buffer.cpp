@@ -0,0 +1,95 @@
+#include "accumulation_buffer.h"
+#include "binary_io.h"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+const char magic[8] = { 'R', 'T', 'A', 'C', 'C', 'U', 'M', '1' };
+
+// 15 doubles, the sample count and the converged flag, in host byte order.
+const size_t record_bytes = 15 * sizeof(double) + sizeof(int32_t) + 1;
+const size_t header_bytes = preamble_bytes + 2 * sizeof(int32_t) + sizeof(uint64_t);
+
+} // namespace
+
+uint64_t accumulation_buffer::total_samples() const {
+    uint64_t total = 0;
+    for (const auto& p : pixels)
+        total += static_cast<uint64_t>(p.count);
+    return total;
+}
+
+bool accumulation_buffer::save(const std::string& path, uint64_t key) const {
+    std::string bytes;
+    bytes.reserve(header_bytes + record_bytes * pixels.size());
+    put_preamble(bytes, magic);
+    put(bytes, static_cast<int32_t>(w));
+    put(bytes, static_cast<int32_t>(h));
+    put(bytes, key);
+    for (const auto& p : pixels) {
+        put(bytes, p.sum);
+        put(bytes, p.sum_sq);
+        put(bytes, p.luminance_sum);
+        put(bytes, p.luminance_sum_sq);
+        put(bytes, p.albedo_sum);
+        put(bytes, p.normal_sum);
+        put(bytes, p.depth_sum);
+        put(bytes, p.count);
+        bytes.push_back(p.converged ? 1 : 0);
+    }
+
+    if (!write_file_atomically(path, bytes.data(), bytes.size())) {
+        std::cerr << "Could not write checkpoint " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool accumulation_buffer::load(const std::string& path, uint64_t key) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open checkpoint " << path << "\n";
+        return false;
+    }
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    const char* cursor = bytes.data();
+    bool same_byte_order = false;
+    if (bytes.size() < header_bytes || !get_preamble(cursor, magic, same_byte_order)) {
+        std::cerr << path << " is not a checkpoint file\n";
+        return false;
+    }
+    if (!same_byte_order) {
+        std::cerr << "Checkpoint " << path << " was written on a machine with a different byte order\n";
+        return false;
+    }
+    int32_t file_width, file_height;
+    uint64_t file_key;
+    get(cursor, file_width);
+    get(cursor, file_height);
+    get(cursor, file_key);
+    if (file_width != w || file_height != h || file_key != key) {
+        std::cerr << "Checkpoint " << path << " was written with different render settings ("
+                  << file_width << "x" << file_height << ")\n";
+        return false;
+    }
+    if (bytes.size() != header_bytes + record_bytes * pixels.size()) {
+        std::cerr << "Checkpoint " << path << " is truncated\n";
+        return false;
+    }
+
+    for (auto& p : pixels) {
+        get(cursor, p.sum);
+        get(cursor, p.sum_sq);
+        get(cursor, p.luminance_sum);
+        get(cursor, p.luminance_sum_sq);
+        get(cursor, p.albedo_sum);
+        get(cursor, p.normal_sum);
+        get(cursor, p.depth_sum);
+        get(cursor, p.count);
+        p.converged = *cursor++ != 0;
+    }
+    return true;
+}
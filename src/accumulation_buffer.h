@@ -0,0 +1,47 @@
+#pragma once
+#include "vec3.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Running sums for one pixel of a progressive render.
+struct pixel_sums {
+    color sum;
+    color sum_sq;
+    double luminance_sum = 0;
+    double luminance_sum_sq = 0;
+    color albedo_sum;
+    vec3 normal_sum;
+    double depth_sum = 0;
+    int32_t count = 0;
+    bool converged = false;   // met the noise threshold; takes no more samples
+};
+
+// Per-pixel sums of a progressive render, bottom row first like the camera's
+// v coordinate. They hold everything needed to resolve the image, its
+// variance and the denoiser guides, so a render can be checkpointed after
+// any pass and resumed later.
+class accumulation_buffer {
+public:
+    accumulation_buffer(int width, int height)
+        : w(width), h(height), pixels(static_cast<size_t>(width) * height) {}
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    pixel_sums& at(int x, int y) { return pixels[static_cast<size_t>(y) * w + x]; }
+    const pixel_sums& at(int x, int y) const { return pixels[static_cast<size_t>(y) * w + x]; }
+
+    uint64_t total_samples() const;
+
+    // Checkpoint files are written to a temporary file and renamed into
+    // place, so an interrupted save never leaves a truncated checkpoint.
+    // key identifies the render settings; load() rejects a file with a
+    // different key or size. Both report failures on std::cerr.
+    bool save(const std::string& path, uint64_t key) const;
+    bool load(const std::string& path, uint64_t key);
+
+private:
+    int w, h;
+    std::vector<pixel_sums> pixels;
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include "pcg32.h"
+#include "vec3.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+
+// Helpers shared by the binary files the renderer writes for itself (mesh
+// caches, texture tiles, checkpoints). Values are stored in host byte order,
+// so every such file starts with an 8-byte magic naming its format and
+// byte_order_mark, which reads back differently on a machine of the other
+// byte order.
+
+const uint32_t byte_order_mark = 0x01020304;
+const size_t preamble_bytes = 8 + sizeof(uint32_t);
+
+template <typename T>
+void put(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+inline void put(std::string& out, const vec3& v) {
+    for (int i = 0; i < 3; ++i)
+        put(out, v[i]);
+}
+
+template <typename T>
+void get(const char*& in, T& value) {
+    std::memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+}
+
+inline void get(const char*& in, vec3& v) {
+    for (int i = 0; i < 3; ++i)
+        get(in, v[i]);
+}
+
+inline void put_preamble(std::string& out, const char (&magic)[8]) {
+    out.append(magic, sizeof(magic));
+    put(out, byte_order_mark);
+}
+
+// Checks the preamble at in (at least preamble_bytes long) and moves past
+// it. False if the magic differs; same_byte_order says whether the file was
+// written on a machine of this byte order.
+inline bool get_preamble(const char*& in, const char (&magic)[8], bool& same_byte_order) {
+    if (std::memcmp(in, magic, sizeof(magic)) != 0)
+        return false;
+    in += sizeof(magic);
+    uint32_t order;
+    get(in, order);
+    same_byte_order = order == byte_order_mark;
+    return true;
+}
+
+// Identifies the file at path by its size and modification time, mixed
+// into seed (a format version, say); 0 if it cannot be read.
+inline uint64_t file_stat_key(const std::string& path, uint64_t seed) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return 0;
+    const uint64_t key = hash_seed(seed, static_cast<uint64_t>(info.st_size));
+    return hash_seed(key, static_cast<uint64_t>(info.st_mtime));
+}
+
+// Writes path + ".tmp" with write(std::ostream&) and renames it into place,
+// so an interrupted write never leaves a truncated file at path. False, with
+// the temporary file removed, if any step fails.
+template <typename Write>
+bool write_file_atomically(const std::string& path, Write&& write) {
+    const std::string temporary = path + ".tmp";
+    bool written = false;
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        write(out);
+        written = static_cast<bool>(out.flush());
+    }
+    if (written && std::rename(temporary.c_str(), path.c_str()) == 0)
+        return true;
+    std::remove(temporary.c_str());
+    return false;
+}
+
+inline bool write_file_atomically(const std::string& path, const char* data, size_t size) {
+    return write_file_atomically(path, [&](std::ostream& out) {
+        out.write(data, static_cast<std::streamsize>(size));
+    });
+}
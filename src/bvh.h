@@ -4,98 +4,407 @@
 #include "hittable.h"
 #include "hittable_list.h"
 #include "aabb.h"
+#include "rtweekend.h"
 #include <algorithm>
+#include <vector>
+
+enum class bvh_split_method { sah, median };
+
+struct bvh_build_options {
+    bvh_split_method method = bvh_split_method::sah;
+    int bin_count = 16;
+    int max_leaf_size = 4;
+    double traversal_cost = 1.0;
+    double intersection_cost = 1.0;
+};
+
+// Build-time view of one primitive: its bounds, their centroid and the
+// primitive's index in whatever container the caller is building over.
+struct bvh_primitive {
+    aabb box;
+    point3 centroid;
+    size_t index;
+};
+
+struct bvh_split {
+    bool make_leaf;
+    size_t mid;
+    int axis;
+};
+
+inline aabb empty_aabb() {
+    return aabb(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+}
+
+// Ranges at least this long are built in parallel: their bounds and bins
+// are gathered in chunks run as OpenMP tasks, and their two subtrees are
+// built as separate tasks. Chunks are merged in order and min/max/count
+// merges are exact, so the tree does not depend on the thread count.
+const size_t bvh_parallel_threshold = 32 * 1024;
+
+inline size_t bvh_chunk_count(size_t count) {
+    return count < bvh_parallel_threshold ? 1 : std::min<size_t>(64, count / (bvh_parallel_threshold / 8));
+}
+
+inline size_t bvh_chunk_start(size_t start, size_t end, size_t chunk, size_t chunks) {
+    return start + (end - start) * chunk / chunks;
+}
+
+// Calls chunk_fn(chunk, first, last) for each chunk of [start, end), as
+// OpenMP tasks when there is more than one.
+template <typename ChunkFn>
+inline void for_each_bvh_chunk(size_t start, size_t end, size_t chunks, ChunkFn&& chunk_fn) {
+    if (chunks == 1) {
+        chunk_fn(0, start, end);
+        return;
+    }
+    #pragma omp taskloop default(shared)
+    for (size_t c = 0; c < chunks; ++c)
+        chunk_fn(c, bvh_chunk_start(start, end, c, chunks), bvh_chunk_start(start, end, c + 1, chunks));
+}
+
+// In-place surrounding_box for the build loops. std::min and std::max
+// compile to single instructions where fmin and fmax (which handle NaNs)
+// stay library calls.
+inline void grow_bounds(aabb& box, const point3& lo, const point3& hi) {
+    for (int a = 0; a < 3; ++a) {
+        box.minimum[a] = std::min(box.minimum[a], lo[a]);
+        box.maximum[a] = std::max(box.maximum[a], hi[a]);
+    }
+}
+
+// The bounds of a range's boxes and of their centroids, which drive the split.
+struct range_bounds {
+    aabb box = empty_aabb();
+    aabb centroids = empty_aabb();
+};
+
+inline range_bounds bounds_of_range(const std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+    auto gather = [&](size_t first, size_t last) {
+        range_bounds b;
+        for (size_t i = first; i < last; ++i) {
+            grow_bounds(b.box, prims[i].box.minimum, prims[i].box.maximum);
+            grow_bounds(b.centroids, prims[i].centroid, prims[i].centroid);
+        }
+        return b;
+    };
+    const size_t chunks = bvh_chunk_count(end - start);
+    if (chunks == 1)
+        return gather(start, end);
+
+    std::vector<range_bounds> partial(chunks);
+    for_each_bvh_chunk(start, end, chunks, [&](size_t c, size_t first, size_t last) {
+        partial[c] = gather(first, last);
+    });
+
+    range_bounds bounds;
+    for (const auto& b : partial) {
+        grow_bounds(bounds.box, b.box.minimum, b.box.maximum);
+        grow_bounds(bounds.centroids, b.centroids.minimum, b.centroids.maximum);
+    }
+    return bounds;
+}
+
+inline aabb primitive_bounds(const std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+    return bounds_of_range(prims, start, end).box;
+}
+
+// Build primitives for objects, in their order.
+template <typename Objects>
+inline std::vector<bvh_primitive> make_bvh_primitives(const Objects& objects, const char* builder) {
+    std::vector<bvh_primitive> prims(objects.size());
+    #pragma omp parallel for schedule(static) if(objects.size() >= bvh_parallel_threshold)
+    for (size_t i = 0; i < objects.size(); ++i) {
+        aabb obj_box;
+        if (!objects[i]->bounding_box(obj_box))
+            std::cerr << "No bounding box in " << builder << " constructor.\n";
+        prims[i] = {obj_box, obj_box.centroid(), i};
+    }
+    return prims;
+}
+
+inline bvh_split median_split(std::vector<bvh_primitive>& prims, size_t start, size_t end, int axis) {
+    size_t mid = start + (end - start) / 2;
+    std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+        [axis](const bvh_primitive& a, const bvh_primitive& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+    return {false, mid, axis};
+}
+
+// Chooses a split for prims[start, end) with the binned surface area heuristic
+// (or an object median, depending on options) and partitions the range around
+// it. Returns make_leaf when keeping the range together is cheaper. All three
+// axes are binned in one pass over the range.
+inline bvh_split partition_primitives(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                                      const range_bounds& bounds, const bvh_build_options& options) {
+    size_t count = end - start;
+    if (count <= 1)
+        return {true, end, 0};
+
+    const aabb& centroid_bounds = bounds.centroids;
+    int axis = centroid_bounds.longest_axis();
+    double extent = centroid_bounds.max()[axis] - centroid_bounds.min()[axis];
+
+    if (extent <= 0.0) {
+        if (count <= static_cast<size_t>(options.max_leaf_size))
+            return {true, end, axis};
+        return {false, start + count / 2, axis};
+    }
+
+    if (options.method == bvh_split_method::median)
+        return median_split(prims, start, end, axis);
+
+    struct bin {
+        aabb box = empty_aabb();
+        size_t count = 0;
+    };
+
+    const int bin_count = std::max(2, options.bin_count);
+    double cmin[3], scale[3];
+    for (int a = 0; a < 3; ++a) {
+        cmin[a] = centroid_bounds.min()[a];
+        const double cext = centroid_bounds.max()[a] - cmin[a];
+        scale[a] = cext > 0.0 ? bin_count / cext : 0.0;
+    }
+
+    // chunk_bins[(c * 3 + a) * bin_count + b]: bin b on axis a of chunk c.
+    const size_t chunks = bvh_chunk_count(count);
+    std::vector<bin> chunk_bins(chunks * 3 * bin_count);
+    for_each_bvh_chunk(start, end, chunks, [&](size_t c, size_t first, size_t last) {
+        bin* local = &chunk_bins[c * 3 * bin_count];
+        for (int a = 0; a < 3; ++a) {
+            const double axis_min = cmin[a], axis_scale = scale[a];
+            if (axis_scale == 0.0)
+                continue;
+            bin* axis_bins = local + a * bin_count;
+            for (size_t i = first; i < last; ++i) {
+                int b = std::min(bin_count - 1, static_cast<int>((prims[i].centroid[a] - axis_min) * axis_scale));
+                bin& target = axis_bins[b];
+                grow_bounds(target.box, prims[i].box.minimum, prims[i].box.maximum);
+                target.count++;
+            }
+        }
+    });
+
+    std::vector<bin> merged(chunks > 1 ? bin_count : 0);
+    std::vector<double> left_area(bin_count), right_area(bin_count);
+    std::vector<size_t> left_count(bin_count), right_count(bin_count);
+
+    double best_cost = infinity;
+    int best_axis = -1;
+    int best_bin = 0;
+
+    for (int a = 0; a < 3; ++a) {
+        if (scale[a] == 0.0)
+            continue;
+
+        const bin* bins = &chunk_bins[a * bin_count];
+        if (chunks > 1) {
+            for (int b = 0; b < bin_count; ++b) {
+                merged[b] = bin();
+                for (size_t c = 0; c < chunks; ++c) {
+                    const bin& part = chunk_bins[(c * 3 + a) * bin_count + b];
+                    grow_bounds(merged[b].box, part.box.minimum, part.box.maximum);
+                    merged[b].count += part.count;
+                }
+            }
+            bins = merged.data();
+        }
+
+        aabb acc = empty_aabb();
+        size_t n = 0;
+        for (int b = 0; b < bin_count - 1; ++b) {
+            grow_bounds(acc, bins[b].box.minimum, bins[b].box.maximum);
+            n += bins[b].count;
+            left_area[b] = n ? acc.surface_area() : 0.0;
+            left_count[b] = n;
+        }
+
+        acc = empty_aabb();
+        n = 0;
+        for (int b = bin_count - 1; b > 0; --b) {
+            grow_bounds(acc, bins[b].box.minimum, bins[b].box.maximum);
+            n += bins[b].count;
+            right_area[b - 1] = n ? acc.surface_area() : 0.0;
+            right_count[b - 1] = n;
+        }
+
+        for (int b = 0; b < bin_count - 1; ++b) {
+            if (left_count[b] == 0 || right_count[b] == 0)
+                continue;
+            double cost = left_area[b] * left_count[b] + right_area[b] * right_count[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+
+    if (best_axis < 0)
+        return median_split(prims, start, end, axis);
+
+    double area = bounds.box.surface_area();
+    double split_cost = options.traversal_cost
+                      + options.intersection_cost * (area > 0.0 ? best_cost / area : count);
+    double leaf_cost = options.intersection_cost * count;
+
+    if (count <= static_cast<size_t>(options.max_leaf_size) && split_cost >= leaf_cost)
+        return {true, end, best_axis};
+
+    const double split_min = cmin[best_axis];
+    const double split_scale = scale[best_axis];
+    auto mid = std::partition(prims.begin() + start, prims.begin() + end,
+        [=](const bvh_primitive& p) {
+            int b = std::min(bin_count - 1, static_cast<int>((p.centroid[best_axis] - split_min) * split_scale));
+            return b <= best_bin;
+        });
+
+    size_t mid_index = static_cast<size_t>(mid - prims.begin());
+    if (mid_index == start || mid_index == end)
+        return median_split(prims, start, end, best_axis);
+
+    return {false, mid_index, best_axis};
+}
 
 class bvh_node : public hittable {
 public:
     bvh_node() {}
-    
-    bvh_node(const hittable_list& list) 
-        : bvh_node(list.objects, 0, list.objects.size()) {}
-    
-    bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects, 
-             size_t start, size_t end) {
-        
-        auto objects = src_objects;
-        
-        int axis = random_int(0, 2); 
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                                      : box_z_compare;
-        
-        size_t object_span = end - start;
-        
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            if (comparator(objects[start], objects[start+1])) {
-                left = objects[start];
-                right = objects[start+1];
-            } else {
-                left = objects[start+1];
-                right = objects[start];
-            }
-        } else {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
-            
-            auto mid = start + object_span / 2;
-            left = std::make_shared<bvh_node>(objects, start, mid);
-            right = std::make_shared<bvh_node>(objects, mid, end);
-        }
-        
-        aabb box_left, box_right;
-        
-        if (!left->bounding_box(box_left) || !right->bounding_box(box_right))
-            std::cerr << "No bounding box in bvh_node constructor.\n";
-        
-        box = surrounding_box(box_left, box_right);
-    }
-    
+
+    bvh_node(const hittable_list& list, const bvh_build_options& options = bvh_build_options())
+        : bvh_node(list.objects, options) {}
+
+    bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects,
+             const bvh_build_options& options = bvh_build_options()) {
+        std::vector<bvh_primitive> prims = make_bvh_primitives(src_objects, "bvh_node");
+        if (prims.empty())
+            return;
+
+        #pragma omp parallel if(prims.size() >= bvh_parallel_threshold)
+        #pragma omp single
+        build(src_objects, prims, 0, prims.size(), options);
+    }
+
+    bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects,
+             std::vector<bvh_primitive>& prims, size_t start, size_t end,
+             const bvh_build_options& options) {
+        build(src_objects, prims, start, end, options);
+    }
+
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
         if (!box.hit(r, t_min, t_max))
             return false;
-        
+
+        if (is_leaf()) {
+            bool hit_anything = false;
+            for (const auto& object : objects) {
+                if (object->hit(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
         bool hit_left = left->hit(r, t_min, t_max, rec);
         bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
-        
+
         return hit_left || hit_right;
     }
-    
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        if (!box.hit(r, t_min, t_max))
+            return false;
+
+        if (is_leaf()) {
+            for (const auto& object : objects) {
+                if (object->occluded(r, t_min, t_max))
+                    return true;
+            }
+            return false;
+        }
+
+        return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        if (!media || !box.hit(r, t_min, t_max))
+            return 1.0;
+
+        if (is_leaf()) {
+            double result = 1.0;
+            for (const auto& object : objects)
+                result *= object->transmittance(r, t_min, t_max);
+            return result;
+        }
+
+        return left->transmittance(r, t_min, t_max) * right->transmittance(r, t_min, t_max);
+    }
+
+    virtual bool has_media() const override { return media; }
+
     virtual bool bounding_box(aabb& output_box) const override {
         output_box = box;
         return true;
     }
 
+    bool is_leaf() const { return !left; }
+
+    size_t primitive_count() const {
+        return is_leaf() ? objects.size() : left->primitive_count() + right->primitive_count();
+    }
+
+    // Expected cost of a random ray through the tree, relative to the root's
+    // surface area. Lower is better; only comparable across the same scene.
+    double sah_cost(const bvh_build_options& options = bvh_build_options()) const {
+        double root_area = box.surface_area();
+        return root_area > 0.0 ? area_weighted_cost(options) / root_area : 0.0;
+    }
+
 public:
-    std::shared_ptr<hittable> left;
-    std::shared_ptr<hittable> right;
+    std::shared_ptr<bvh_node> left;
+    std::shared_ptr<bvh_node> right;
+    std::vector<std::shared_ptr<hittable>> objects;
     aabb box;
-    
-    static bool box_compare(const std::shared_ptr<hittable> a, 
-                           const std::shared_ptr<hittable> b, int axis) {
-        aabb box_a;
-        aabb box_b;
-        
-        if (!a->bounding_box(box_a) || !b->bounding_box(box_b))
-            std::cerr << "No bounding box in bvh_node constructor.\n";
-        
-        return box_a.min()[axis] < box_b.min()[axis];
-    }
-    
-    static bool box_x_compare(const std::shared_ptr<hittable> a, 
-                             const std::shared_ptr<hittable> b) {
-        return box_compare(a, b, 0);
-    }
-    
-    static bool box_y_compare(const std::shared_ptr<hittable> a, 
-                             const std::shared_ptr<hittable> b) {
-        return box_compare(a, b, 1);
-    }
-    
-    static bool box_z_compare(const std::shared_ptr<hittable> a, 
-                             const std::shared_ptr<hittable> b) {
-        return box_compare(a, b, 2);
+    int axis = 0;
+
+private:
+    bool media = false;   // anywhere in the subtree
+
+    void build(const std::vector<std::shared_ptr<hittable>>& src_objects,
+               std::vector<bvh_primitive>& prims, size_t start, size_t end,
+               const bvh_build_options& options) {
+        const range_bounds bounds = bounds_of_range(prims, start, end);
+        box = bounds.box;
+
+        bvh_split split = partition_primitives(prims, start, end, bounds, options);
+
+        if (split.make_leaf) {
+            objects.reserve(end - start);
+            for (size_t i = start; i < end; ++i) {
+                objects.push_back(src_objects[prims[i].index]);
+                media = media || objects.back()->has_media();
+            }
+            return;
+        }
+
+        axis = split.axis;
+        #pragma omp task default(shared) if(split.mid - start >= bvh_parallel_threshold)
+        left = std::make_shared<bvh_node>(src_objects, prims, start, split.mid, options);
+        right = std::make_shared<bvh_node>(src_objects, prims, split.mid, end, options);
+        #pragma omp taskwait
+        media = left->has_media() || right->has_media();
+    }
+
+    double area_weighted_cost(const bvh_build_options& options) const {
+        double area = box.surface_area();
+        if (is_leaf())
+            return area * options.intersection_cost * objects.size();
+        return area * options.traversal_cost
+             + left->area_weighted_cost(options)
+             + right->area_weighted_cost(options);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
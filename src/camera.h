@@ -2,6 +2,7 @@
 #include "vec3.h"        
 #include "ray.h"        
 #include "rtweekend.h" 
+#include "sampler.h"
 
 class camera {
 public:
@@ -31,17 +32,25 @@ public:
         lens_radius = aperture / 2;
     }
 
-    ray get_ray(double s, double t) const {
-        vec3 rd = lens_radius * random_in_unit_disk();
+    // Gives camera rays differentials toward the neighbouring pixels, which
+    // are ds and dt apart in get_ray's coordinates.
+    void set_pixel_spacing(double ds, double dt) {
+        pixel_ds = ds;
+        pixel_dt = dt;
+    }
+
+    // Uses two sampler dimensions for the lens and one for the shutter time.
+    ray get_ray(double s, double t, sampler& samp) const {
+        vec3 rd = lens_radius * sample_unit_disk(samp.get_2d());
         vec3 offset = u * rd.x() + v * rd.y();
         
-        double time = random_double(0.0, 1.0);
+        double time = samp.get_1d();
+        vec3 direction = lower_left_corner + s*horizontal + t*vertical - origin - offset;
     
-        return ray(
-            origin + offset,
-            lower_left_corner + s*horizontal + t*vertical - origin - offset,
-            time
-        );
+        ray r(origin + offset, direction, time);
+        if (pixel_ds > 0 || pixel_dt > 0)
+            r.set_differentials({ r.origin(), r.origin(), direction + pixel_ds*horizontal, direction + pixel_dt*vertical });
+        return r;
     }    
 
 private:
@@ -51,4 +60,5 @@ private:
     vec3 vertical;
     vec3 u, v, w;        
     double lens_radius;
+    double pixel_ds = 0, pixel_dt = 0;
 };
\ No newline at end of file
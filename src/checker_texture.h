@@ -22,20 +22,24 @@ public:
     }
 
     virtual color value(double u, double v, const point3& p) const override {
+        return pick(p).value(u, v, p);
+    }
+
+    virtual color filtered_value(const hit_record& rec) const override {
+        return pick(rec.p).filtered_value(rec);
+    }
+
+private:
+    const texture& pick(const point3& p) const {
         double s = sin(10.0 * p.x());
         double t = sin(10.0 * p.y());
         double r = sin(10.0 * p.z());
 
         double sines = s * t * r;
 
-        if (sines < 0.0) {
-            return odd->value(u, v, p);
-        } else {
-            return even->value(u, v, p);
-        }
+        return sines < 0.0 ? *odd : *even;
     }
 
-private:
     std::shared_ptr<texture> odd;  
     std::shared_ptr<texture> even;
 };
\ No newline at end of file
@@ -8,23 +8,14 @@ inline double clamp(double x, double min, double max) {
     return x;
 }
 
-inline void write_color(std::ostream& out, color pixel_color, int samples_per_pixel) {
-    double r = pixel_color.x();
-    double g = pixel_color.y();
-    double b = pixel_color.z();
+// Gamma 2 and 8-bit quantization of one linear channel.
+inline int to_byte(double linear) {
+    return static_cast<int>(256 * clamp(sqrt(linear), 0.0, 0.999));
+}
 
+inline void write_color(std::ostream& out, color pixel_color, int samples_per_pixel) {
     double scale = 1.0 / samples_per_pixel;
-    r *= scale;
-    g *= scale;
-    b *= scale;
-
-    r = sqrt(r);
-    g = sqrt(g);
-    b = sqrt(b);
-
-    int ir = static_cast<int>(256 * clamp(r, 0.0, 0.999));
-    int ig = static_cast<int>(256 * clamp(g, 0.0, 0.999));
-    int ib = static_cast<int>(256 * clamp(b, 0.0, 0.999));
-
-    out << ir << ' ' << ig << ' ' << ib << '\n';
+    out << to_byte(pixel_color.x() * scale) << ' '
+        << to_byte(pixel_color.y() * scale) << ' '
+        << to_byte(pixel_color.z() * scale) << '\n';
 }
\ No newline at end of file
@@ -10,59 +10,84 @@ public:
     isotropic(std::shared_ptr<texture> a) : albedo(a) {}
     isotropic(color c) : albedo(std::make_shared<solid_color>(c)) {}
 
-    virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-        scattered = ray(rec.p, random_unit_vector(), r_in.time());
+    virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& samp) const override {
+        scattered = ray(rec.p, sample_unit_sphere(samp.get_2d()), r_in.time());
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
 
+    virtual bool is_specular() const override { return false; }
+
+    virtual color eval(const ray& r_in, const hit_record& rec, const vec3& wi) const override {
+        return albedo->value(rec.u, rec.v, rec.p) / (4.0 * pi);
+    }
+
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const override {
+        return 1.0 / (4.0 * pi);
+    }
+
+    virtual color reflectance(const hit_record& rec) const override {
+        return albedo->value(rec.u, rec.v, rec.p);
+    }
+
 public:
     std::shared_ptr<texture> albedo;
 };
 
+// Constant density inside boundary, which must be closed and convex. Free
+// paths are sampled exactly, and shadow rays are attenuated by the exact
+// transmittance through the boundary.
 class constant_medium : public hittable {
 public:
     constant_medium(std::shared_ptr<hittable> b, double d, std::shared_ptr<texture> a)
-        : boundary(b), neg_inv_density(-1/d), phase_function(std::make_shared<isotropic>(a)) {}
-    
+        : boundary(b), phase_function(std::make_shared<isotropic>(a)), density(d), neg_inv_density(-1/d) {
+        has_box = boundary->bounding_box(box);
+    }
+
     constant_medium(std::shared_ptr<hittable> b, double d, color c)
-        : boundary(b), neg_inv_density(-1/d), phase_function(std::make_shared<isotropic>(c)) {}
+        : boundary(b), phase_function(std::make_shared<isotropic>(c)), density(d), neg_inv_density(-1/d) {
+        has_box = boundary->bounding_box(box);
+    }
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
-        hit_record rec1, rec2;
-
-        if (!boundary->hit(r, -infinity, infinity, rec1))
-            return false;
-
-        if (!boundary->hit(r, rec1.t+0.0001, infinity, rec2))
+        double t0, t1;
+        if (!inside(r, t_min, t_max, t0, t1))
             return false;
 
-        if (rec1.t < t_min) rec1.t = t_min;
-        if (rec2.t > t_max) rec2.t = t_max;
-
-        if (rec1.t >= rec2.t)
-            return false;
-
-        if (rec1.t < 0)
-            rec1.t = 0;
-
         const auto ray_length = r.direction().length();
-        const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-        const auto hit_distance = neg_inv_density * log(random_double());
+        const auto distance_inside_boundary = (t1 - t0) * ray_length;
+        // hit() has no sampler argument; the per-thread generator is the same
+        // one the render loop reseeds for every pixel sample.
+        const auto hit_distance = neg_inv_density * log(random_double(thread_rng()));
 
         if (hit_distance > distance_inside_boundary)
             return false;
 
-        rec.t = rec1.t + hit_distance / ray_length;
+        rec.t = t0 + hit_distance / ray_length;
         rec.p = r.at(rec.t);
 
         rec.normal = vec3(1,0,0);
         rec.front_face = true;
-        rec.mat_ptr = phase_function;
+        rec.set_partials(vec3(), vec3(), vec3(), vec3());
+        rec.mat_ptr = phase_function.get();
+        rec.object = this;
 
         return true;
     }
 
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        return false;
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        double t0, t1;
+        if (!inside(r, t_min, t_max, t0, t1))
+            return 1.0;
+        return exp(-density * (t1 - t0) * r.direction().length());
+    }
+
+    virtual bool has_media() const override { return true; }
+
     virtual bool bounding_box(aabb& output_box) const override {
         return boundary->bounding_box(output_box);
     }
@@ -70,5 +95,34 @@ public:
 public:
     std::shared_ptr<hittable> boundary;
     std::shared_ptr<material> phase_function;
+    double density;
     double neg_inv_density;
+
+private:
+    aabb box;
+    bool has_box = false;
+
+    // The part [t0, t1] of [t_min, t_max] inside the boundary. Rays that miss
+    // the boundary's box skip the two boundary intersections.
+    bool inside(const ray& r, double t_min, double t_max, double& t0, double& t1) const {
+        if (has_box && !box.hit(r, t_min, t_max))
+            return false;
+
+        hit_record rec1, rec2;
+
+        if (!boundary->hit(r, -infinity, infinity, rec1))
+            return false;
+
+        if (!boundary->hit(r, rec1.t+0.0001, infinity, rec2))
+            return false;
+
+        t0 = fmax(rec1.t, t_min);
+        t1 = fmin(rec2.t, t_max);
+        if (t0 >= t1)
+            return false;
+
+        if (t0 < 0)
+            t0 = 0;
+        return true;
+    }
 };
\ No newline at end of file
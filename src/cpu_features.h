@@ -0,0 +1,66 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RT_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Instruction sets a SIMD kernel can be written for, narrowest first.
+enum class simd_kernel { scalar, sse, avx2 };
+
+#if defined(_MSC_VER)
+#define RT_TARGET_AVX2
+#else
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// True when both the CPU and the OS (saved YMM state) support AVX2.
+inline bool cpu_has_avx2() {
+#if defined(RT_X86)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) return false;
+    __cpuid(regs, 1);
+    ecx = regs[2];
+#else
+    if (__get_cpuid_max(0, nullptr) < 7) return false;
+    __cpuid(1, eax, ebx, ecx, edx);
+#endif
+    const bool osxsave = (ecx & (1u << 27)) != 0;
+    const bool avx = (ecx & (1u << 28)) != 0;
+    if (!osxsave || !avx) return false;
+
+#if defined(_MSC_VER)
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    unsigned long long xcr0 = (static_cast<unsigned long long>(xcr0_hi) << 32) | xcr0_lo;
+#endif
+    if ((xcr0 & 0x6) != 0x6) return false;
+
+#if defined(_MSC_VER)
+    __cpuidex(regs, 7, 0);
+    ebx = regs[1];
+#else
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+#endif
+    return (ebx & (1u << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+inline bool cpu_has_sse() {
+#if defined(RT_X86)
+    return true;
+#else
+    return false;
+#endif
+}
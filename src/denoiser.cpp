@@ -0,0 +1,142 @@
+#include "denoiser.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+double luminance(const color& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// Albedo channels too dark to divide by are left in the signal.
+color demodulation(const color& albedo) {
+    const double min_albedo = 1e-3;
+    return color(albedo.x() > min_albedo ? albedo.x() : 1.0,
+                 albedo.y() > min_albedo ? albedo.y() : 1.0,
+                 albedo.z() > min_albedo ? albedo.z() : 1.0);
+}
+
+// The one-sided difference with the smaller magnitude, so that a depth
+// edge next to the pixel does not inflate its gradient.
+double depth_slope(const std::vector<double>& depth, int width, int height, int x, int y, int dx, int dy) {
+    const size_t p = static_cast<size_t>(y) * width + x;
+    double best = 0;
+    bool found = false;
+    for (int s = -1; s <= 1; s += 2) {
+        const int qx = x + s * dx, qy = y + s * dy;
+        if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+            continue;
+        const double d = s * (depth[static_cast<size_t>(qy) * width + qx] - depth[p]);
+        if (!found || std::fabs(d) < std::fabs(best)) {
+            best = d;
+            found = true;
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+image_buffer denoise(const image_buffer& image, const std::vector<double>& variance,
+                     const aov_buffers& aovs, const denoise_options& options) {
+    const int width = image.width, height = image.height;
+    const size_t count = image.pixels.size();
+    const double kernel[5] = { 1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16 };
+    const double epsilon = 1e-10;
+
+    std::vector<color> lighting(count);
+    std::vector<double> lighting_variance(count);
+    std::vector<double> gradient_x(count), gradient_y(count);
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const size_t p = static_cast<size_t>(y) * width + x;
+            const color a = demodulation(aovs.albedo.pixels[p]);
+            const color& c = image.pixels[p];
+            lighting[p] = color(c.x() / a.x(), c.y() / a.y(), c.z() / a.z());
+            const double scale = luminance(a);
+            lighting_variance[p] = variance[p] / (scale * scale);
+            gradient_x[p] = depth_slope(aovs.depth, width, height, x, y, 1, 0);
+            gradient_y[p] = depth_slope(aovs.depth, width, height, x, y, 0, 1);
+        }
+    }
+
+    std::vector<color> next_lighting(count);
+    std::vector<double> next_variance(count), blurred_variance(count);
+    for (int iteration = 0; iteration < options.iterations; ++iteration) {
+        const int step = 1 << iteration;
+
+        // The luminance test uses a 3x3 blur of the variance, which is
+        // itself a noisy estimate.
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                double sum = 0, weight_sum = 0;
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        const int qx = x + dx, qy = y + dy;
+                        if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                            continue;
+                        const double w = kernel[dx + 2] * kernel[dy + 2];
+                        sum += w * lighting_variance[static_cast<size_t>(qy) * width + qx];
+                        weight_sum += w;
+                    }
+                }
+                blurred_variance[static_cast<size_t>(y) * width + x] = sum / weight_sum;
+            }
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const size_t p = static_cast<size_t>(y) * width + x;
+                const vec3& np = aovs.normal.pixels[p];
+                if (np.length_squared() == 0) {
+                    next_lighting[p] = lighting[p];
+                    next_variance[p] = lighting_variance[p];
+                    continue;
+                }
+
+                const double zp = aovs.depth[p];
+                const double lp = luminance(lighting[p]);
+                const double luminance_scale = options.sigma_luminance * std::sqrt(blurred_variance[p]) + epsilon;
+
+                color sum(0, 0, 0);
+                double variance_sum = 0, weight_sum = 0;
+                for (int dy = -2; dy <= 2; ++dy) {
+                    for (int dx = -2; dx <= 2; ++dx) {
+                        const int qx = x + dx * step, qy = y + dy * step;
+                        if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                            continue;
+                        const size_t q = static_cast<size_t>(qy) * width + qx;
+
+                        double w = kernel[dx + 2] * kernel[dy + 2];
+                        if (q != p) {
+                            const double cosine = dot(np, aovs.normal.pixels[q]);
+                            // Allow the change the depth gradient predicts, plus a
+                            // little for noise in the averaged depth itself.
+                            const double expected_depth_change =
+                                std::fabs(gradient_x[p] * dx * step + gradient_y[p] * dy * step) + 1e-3 * zp;
+                            w *= std::pow(std::max(0.0, cosine), options.sigma_normal)
+                               * std::exp(-std::fabs(zp - aovs.depth[q])
+                                          / (options.sigma_depth * expected_depth_change + epsilon)
+                                          - std::fabs(lp - luminance(lighting[q])) / luminance_scale);
+                        }
+                        sum += w * lighting[q];
+                        variance_sum += w * w * lighting_variance[q];
+                        weight_sum += w;
+                    }
+                }
+                next_lighting[p] = sum / weight_sum;
+                next_variance[p] = variance_sum / (weight_sum * weight_sum);
+            }
+        }
+        lighting.swap(next_lighting);
+        lighting_variance.swap(next_variance);
+    }
+
+    image_buffer result(width, height);
+    for (size_t p = 0; p < count; ++p)
+        result.pixels[p] = lighting[p] * demodulation(aovs.albedo.pixels[p]);
+    return result;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "image_buffer.h"
+#include <vector>
+
+// Per-pixel denoiser guides, top row first like image_buffer. Pixels with a
+// zero normal (the sky) are left as rendered.
+struct aov_buffers {
+    image_buffer albedo;
+    image_buffer normal;
+    std::vector<double> depth;
+
+    aov_buffers() {}
+    aov_buffers(int w, int h) : albedo(w, h), normal(w, h), depth(static_cast<size_t>(w) * h, 0.0) {}
+};
+
+struct denoise_options {
+    int iterations = 5;
+    double sigma_luminance = 4.0;   // in standard deviations of the pixel's noise
+    double sigma_normal = 128.0;    // exponent on the normals' cosine
+    double sigma_depth = 1.0;       // in units of the local depth gradient
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the
+// variance-guided edge-stopping functions of SVGF (Schied et al. 2017).
+// variance holds the variance of each pixel's mean luminance, so converged
+// pixels are barely touched. Lighting is filtered with the albedo divided
+// out and multiplied back afterward, which keeps texture detail sharp.
+image_buffer denoise(const image_buffer& image, const std::vector<double>& variance,
+                     const aov_buffers& aovs, const denoise_options& options = denoise_options());
@@ -11,7 +11,8 @@ public:
         const ray& r_in,
         const hit_record& rec,
         color& attenuation,
-        ray& scattered
+        ray& scattered,
+        sampler& samp
     ) const override {
         attenuation = color(1.0, 1.0, 1.0);
         double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
@@ -22,16 +23,17 @@ public:
 
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         vec3 direction;
+        bool refracted = false;
 
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > samp.get_1d())
             direction = reflect(unit_direction, rec.normal);
         else {
-            vec3 refracted;
-            refract(unit_direction, rec.normal, refraction_ratio, refracted);
-            direction = refracted;
+            refract(unit_direction, rec.normal, refraction_ratio, direction);
+            refracted = true;
         }
 
         scattered = ray(rec.p, direction);
+        set_specular_differentials(r_in, rec, refracted, refraction_ratio, scattered);
         return true;
     }
 
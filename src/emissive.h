@@ -5,18 +5,20 @@
 
 class emissive : public material {
 public:
-    emissive(const color& emit) : emit_color(emit) {}
+    // One-sided emitters only light the side their outward normal faces.
+    emissive(const color& emit, bool two_sided = true) : emit_color(emit), two_sided(two_sided) {}
 
-    virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+    virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& samp) const override {
         return false;
     }
 
-    virtual color emitted() const override {
-        return emit_color;
+    virtual color emitted(const hit_record& rec) const override {
+        return rec.front_face || two_sided ? emit_color : color(0, 0, 0);
     }
 
 private:
     color emit_color;
+    bool two_sided;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,311 @@
+#include "grid_medium.h"
+#include "binary_io.h"
+#include "mapped_file.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char brick_magic[8] = { 'R', 'T', 'B', 'R', 'I', 'C', 'K', '1' };
+
+bool valid_densities(const float* values, size_t count, const std::string& source) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!(values[i] >= 0) || !std::isfinite(values[i])) {
+            std::cerr << source << ": density " << values[i] << " is negative or not finite\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool voxel_grid::reset(int nx, int ny, int nz) {
+    if (nx <= 0 || ny <= 0 || nz <= 0 || static_cast<double>(nx) * ny * nz > 4294967295.0) {
+        std::cerr << "Invalid voxel grid size " << nx << " x " << ny << " x " << nz << "\n";
+        return false;
+    }
+    dims[0] = nx;
+    dims[1] = ny;
+    dims[2] = nz;
+    for (int a = 0; a < 3; ++a)
+        brick_dims[a] = (dims[a] + brick_size - 1) / brick_size;
+    brick_index.assign(static_cast<size_t>(brick_dims[0]) * brick_dims[1] * brick_dims[2], -1);
+    data.clear();
+    majorants.clear();
+    return true;
+}
+
+bool voxel_grid::set_dense(const float* values, int nx, int ny, int nz) {
+    if (!reset(nx, ny, nz) || !valid_densities(values, static_cast<size_t>(nx) * ny * nz, "Voxel grid"))
+        return false;
+
+    float brick[brick_voxels];
+    for (int bz = 0; bz < brick_dims[2]; ++bz) {
+        for (int by = 0; by < brick_dims[1]; ++by) {
+            for (int bx = 0; bx < brick_dims[0]; ++bx) {
+                // Voxels past the end of the lattice stay zero; lookups clamp
+                // before reaching them.
+                bool empty = true;
+                for (int z = 0; z < brick_size; ++z) {
+                    for (int y = 0; y < brick_size; ++y) {
+                        for (int x = 0; x < brick_size; ++x) {
+                            const int gx = bx * brick_size + x, gy = by * brick_size + y, gz = bz * brick_size + z;
+                            float v = 0.0f;
+                            if (gx < nx && gy < ny && gz < nz)
+                                v = values[(static_cast<size_t>(gz) * ny + gy) * nx + gx];
+                            brick[(z * brick_size + y) * brick_size + x] = v;
+                            empty = empty && v == 0.0f;
+                        }
+                    }
+                }
+                if (empty)
+                    continue;
+                brick_index[brick_offset(bx, by, bz)] = static_cast<int32_t>(stored_bricks());
+                data.insert(data.end(), brick, brick + brick_voxels);
+            }
+        }
+    }
+    build_majorants();
+    return true;
+}
+
+bool voxel_grid::load_dense(const std::string& path, int nx, int ny, int nz) {
+    if (!reset(nx, ny, nz))
+        return false;
+    auto file = mapped_file::open(path);
+    if (!file) {
+        std::cerr << "Could not open voxel file " << path << "\n";
+        return false;
+    }
+    const size_t expected = static_cast<size_t>(nx) * ny * nz * sizeof(float);
+    if (file->size() != expected) {
+        std::cerr << "Voxel file " << path << " has " << file->size() << " bytes; " << nx << " x " << ny << " x "
+                  << nz << " floats take " << expected << "\n";
+        return false;
+    }
+    std::vector<float> values(file->size() / sizeof(float));
+    std::memcpy(values.data(), file->data(), file->size());
+    return set_dense(values.data(), nx, ny, nz);
+}
+
+bool voxel_grid::load_bricks(const std::string& path) {
+    auto file = mapped_file::open(path);
+    const size_t header_bytes = sizeof(brick_magic) + 4 * sizeof(uint32_t);
+    if (!file || file->size() < header_bytes || std::memcmp(file->data(), brick_magic, sizeof(brick_magic)) != 0) {
+        std::cerr << "Could not open " << path << " as a brick file\n";
+        return false;
+    }
+
+    const char* cursor = file->data() + sizeof(brick_magic);
+    uint32_t nx, ny, nz, count;
+    get(cursor, nx);
+    get(cursor, ny);
+    get(cursor, nz);
+    get(cursor, count);
+    const size_t record_bytes = 3 * sizeof(uint32_t) + brick_voxels * sizeof(float);
+    if (file->size() != header_bytes + count * record_bytes) {
+        std::cerr << "Brick file " << path << " should hold " << count << " bricks in "
+                  << header_bytes + count * record_bytes << " bytes but has " << file->size() << "\n";
+        return false;
+    }
+    if (nx > 0x7fffffff || ny > 0x7fffffff || nz > 0x7fffffff
+        || !reset(static_cast<int>(nx), static_cast<int>(ny), static_cast<int>(nz)))
+        return false;
+
+    float brick[brick_voxels];
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t b[3];
+        for (auto& c : b)
+            get(cursor, c);
+        std::memcpy(brick, cursor, sizeof(brick));
+        cursor += sizeof(brick);
+        if (b[0] >= static_cast<uint32_t>(brick_dims[0]) || b[1] >= static_cast<uint32_t>(brick_dims[1])
+            || b[2] >= static_cast<uint32_t>(brick_dims[2])) {
+            std::cerr << "Brick file " << path << ": brick " << b[0] << " " << b[1] << " " << b[2]
+                      << " is outside the " << nx << " x " << ny << " x " << nz << " grid\n";
+            return false;
+        }
+        int32_t& index = brick_index[brick_offset(b[0], b[1], b[2])];
+        if (index >= 0) {
+            std::cerr << "Brick file " << path << ": brick " << b[0] << " " << b[1] << " " << b[2]
+                      << " is listed twice\n";
+            return false;
+        }
+        if (!valid_densities(brick, brick_voxels, path))
+            return false;
+        index = static_cast<int32_t>(stored_bricks());
+        data.insert(data.end(), brick, brick + brick_voxels);
+    }
+    build_majorants();
+    return true;
+}
+
+// Interpolation anywhere in a brick reads the voxels one past its faces, so
+// a brick's majorant is the largest of those and its own. Bricks with
+// no stored brick around them are zero without looking.
+void voxel_grid::build_majorants() {
+    majorants.assign(brick_index.size(), 0.0f);
+    #pragma omp parallel for schedule(dynamic)
+    for (int bz = 0; bz < brick_dims[2]; ++bz) {
+        for (int by = 0; by < brick_dims[1]; ++by) {
+            for (int bx = 0; bx < brick_dims[0]; ++bx) {
+                bool near_data = false;
+                for (int z = std::max(bz - 1, 0); z <= std::min(bz + 1, brick_dims[2] - 1); ++z)
+                    for (int y = std::max(by - 1, 0); y <= std::min(by + 1, brick_dims[1] - 1); ++y)
+                        for (int x = std::max(bx - 1, 0); x <= std::min(bx + 1, brick_dims[0] - 1); ++x)
+                            near_data = near_data || brick_index[brick_offset(x, y, z)] >= 0;
+                if (!near_data)
+                    continue;
+
+                float bound = 0.0f;
+                for (int z = bz * brick_size - 1; z <= (bz + 1) * brick_size; ++z)
+                    for (int y = by * brick_size - 1; y <= (by + 1) * brick_size; ++y)
+                        for (int x = bx * brick_size - 1; x <= (bx + 1) * brick_size; ++x)
+                            bound = std::max(bound, voxel(x, y, z));
+                majorants[brick_offset(bx, by, bz)] = bound;
+            }
+        }
+    }
+}
+
+double voxel_grid::density(const point3& p) const {
+    const double x = p.x() - 0.5, y = p.y() - 0.5, z = p.z() - 0.5;
+    const double fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+    const int x0 = static_cast<int>(fx), y0 = static_cast<int>(fy), z0 = static_cast<int>(fz);
+    const double tx = x - fx, ty = y - fy, tz = z - fz;
+
+    double planes[2];
+    for (int dz = 0; dz < 2; ++dz) {
+        double rows[2];
+        for (int dy = 0; dy < 2; ++dy) {
+            const double a = voxel(x0, y0 + dy, z0 + dz), b = voxel(x0 + 1, y0 + dy, z0 + dz);
+            rows[dy] = a + tx * (b - a);
+        }
+        planes[dz] = rows[0] + ty * (rows[1] - rows[0]);
+    }
+    return planes[0] + tz * (planes[1] - planes[0]);
+}
+
+grid_medium::grid_medium(std::shared_ptr<const voxel_grid> g, const aabb& b, double scale, color albedo)
+    : grid(g), phase_function(std::make_shared<isotropic>(albedo)), box(b), density_scale(scale) {
+    const vec3 extent = box.max() - box.min();
+    voxels_per_unit = vec3(grid->size(0) / extent.x(), grid->size(1) / extent.y(), grid->size(2) / extent.z());
+}
+
+// Calls segment(t0, t1, majorant, local) for each brick r crosses within
+// [t_min, t_max], front to back, until it returns false. The majorant is in
+// the medium's units (scaled by density_scale), and local is r in voxel
+// units, where densities are looked up. Bricks with a zero majorant are
+// stepped over without a call.
+template <typename Segment>
+void grid_medium::march(const ray& r, double t_min, double t_max, Segment&& segment) const {
+    double t0 = t_min, t1 = t_max;
+    for (int a = 0; a < 3; ++a) {
+        const double inv = 1.0 / r.direction()[a];
+        double near = (box.min()[a] - r.origin()[a]) * inv;
+        double far = (box.max()[a] - r.origin()[a]) * inv;
+        if (inv < 0)
+            std::swap(near, far);
+        t0 = std::fmax(t0, near);
+        t1 = std::fmin(t1, far);
+    }
+    if (!(t0 < t1))
+        return;
+
+    const ray local((r.origin() - box.min()) * voxels_per_unit, r.direction() * voxels_per_unit, r.time());
+    int cell[3], step[3];
+    double t_next[3], t_delta[3];
+    for (int a = 0; a < 3; ++a) {
+        const double origin = local.origin()[a] / voxel_grid::brick_size;
+        const double direction = local.direction()[a] / voxel_grid::brick_size;
+        cell[a] = static_cast<int>(std::floor(origin + t0 * direction));
+        cell[a] = std::min(std::max(cell[a], 0), grid->bricks(a) - 1);
+        if (direction > 0) {
+            step[a] = 1;
+            t_next[a] = (cell[a] + 1 - origin) / direction;
+            t_delta[a] = 1 / direction;
+        } else if (direction < 0) {
+            step[a] = -1;
+            t_next[a] = (cell[a] - origin) / direction;
+            t_delta[a] = -1 / direction;
+        } else {
+            step[a] = 0;
+            t_next[a] = infinity;
+            t_delta[a] = infinity;
+        }
+    }
+
+    double t = t0;
+    while (t < t1) {
+        const int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+        const double t_exit = std::fmin(t_next[axis], t1);
+        const double majorant = density_scale * grid->majorant(cell[0], cell[1], cell[2]);
+        if (majorant > 0 && t_exit > t && !segment(t, t_exit, majorant, local))
+            return;
+        t = std::fmax(t, t_exit);
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= grid->bricks(axis))
+            return;
+        t_next[axis] += t_delta[axis];
+    }
+}
+
+bool grid_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    // As in constant_medium, tracking draws from the thread's generator.
+    pcg32& rng = thread_rng();
+    const double length = r.direction().length();
+    bool scattered = false;
+    march(r, t_min, t_max, [&](double t, double t_end, double majorant, const ray& local) {
+        // Delta tracking: tentative collisions at the majorant's rate, each
+        // one real with probability density / majorant.
+        for (;;) {
+            t -= std::log(1 - random_double(rng)) / (majorant * length);
+            if (t >= t_end)
+                return true;
+            if (random_double(rng) * majorant < density_scale * grid->density(local.at(t))) {
+                rec.t = t;
+                scattered = true;
+                return false;
+            }
+        }
+    });
+    if (!scattered)
+        return false;
+
+    rec.p = r.at(rec.t);
+    rec.normal = vec3(1,0,0);
+    rec.front_face = true;
+    rec.u = rec.v = 0;
+    rec.set_partials(vec3(), vec3(), vec3(), vec3());
+    rec.mat_ptr = phase_function.get();
+    rec.object = this;
+    return true;
+}
+
+double grid_medium::transmittance(const ray& r, double t_min, double t_max) const {
+    pcg32& rng = thread_rng();
+    const double length = r.direction().length();
+    double result = 1.0;
+    march(r, t_min, t_max, [&](double t, double t_end, double majorant, const ray& local) {
+        // Ratio tracking: the same tentative collisions, each scaling the
+        // estimate by the chance it was a null collision.
+        for (;;) {
+            t -= std::log(1 - random_double(rng)) / (majorant * length);
+            if (t >= t_end)
+                return true;
+            result *= std::fmax(0.0, 1 - density_scale * grid->density(local.at(t)) / majorant);
+            // Russian roulette once little light is left, so that thick
+            // media do not cost a lookup per collision all the way through.
+            if (result < 0.1) {
+                if (result <= 0 || random_double(rng) >= 0.5) {
+                    result = 0;
+                    return false;
+                }
+                result *= 2;
+            }
+        }
+    });
+    return result;
+}
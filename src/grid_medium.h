@@ -0,0 +1,108 @@
+#pragma once
+#include "constant_medium.h"
+#include "hittable.h"
+#include "rtweekend.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Densities on an nx*ny*nz voxel lattice, stored in bricks of 8^3 voxels.
+// Bricks that are zero throughout take only an index entry. Every brick
+// also keeps a majorant, an upper bound on the interpolated density inside
+// it.
+//
+// Dense files hold nx*ny*nz floats, x fastest. Brick files start with
+// "RTBRICK1", then uint32 nx, ny, nz and the brick count. Each brick follows
+// as uint32 bx, by, bz (its position in bricks) and 512 floats, x fastest.
+// Bricks not listed are zero. Both formats are in host byte order, and
+// densities must be finite and non-negative.
+class voxel_grid {
+public:
+    static const int brick_size = 8;
+
+    // These report problems with the file or the values on std::cerr and
+    // return false.
+    bool load_dense(const std::string& path, int nx, int ny, int nz);
+    bool load_bricks(const std::string& path);
+    bool set_dense(const float* values, int nx, int ny, int nz);
+
+    int size(int axis) const { return dims[axis]; }
+    int bricks(int axis) const { return brick_dims[axis]; }
+    size_t stored_bricks() const { return data.size() / brick_voxels; }
+    size_t memory_bytes() const {
+        return brick_index.size() * sizeof(int32_t) + (data.size() + majorants.size()) * sizeof(float);
+    }
+
+    // Voxel (x, y, z), clamped to the lattice.
+    float voxel(int x, int y, int z) const {
+        x = std::min(std::max(x, 0), dims[0] - 1);
+        y = std::min(std::max(y, 0), dims[1] - 1);
+        z = std::min(std::max(z, 0), dims[2] - 1);
+        const int32_t b = brick_index[brick_offset(x / brick_size, y / brick_size, z / brick_size)];
+        if (b < 0)
+            return 0.0f;
+        const int m = brick_size - 1;
+        return data[static_cast<size_t>(b) * brick_voxels + ((z & m) * brick_size + (y & m)) * brick_size + (x & m)];
+    }
+
+    // Trilinear interpolation at p in voxel units; voxel i is centered at
+    // i + 0.5 along each axis.
+    double density(const point3& p) const;
+
+    float majorant(int bx, int by, int bz) const { return majorants[brick_offset(bx, by, bz)]; }
+
+private:
+    static const int brick_voxels = brick_size * brick_size * brick_size;
+
+    int dims[3] = { 0, 0, 0 };
+    int brick_dims[3] = { 0, 0, 0 };
+    std::vector<int32_t> brick_index;   // per brick, x fastest; -1 if empty
+    std::vector<float> data;            // the stored bricks
+    std::vector<float> majorants;       // per brick
+
+    size_t brick_offset(int bx, int by, int bz) const {
+        return (static_cast<size_t>(bz) * brick_dims[1] + by) * brick_dims[0] + bx;
+    }
+    bool reset(int nx, int ny, int nz);
+    void build_majorants();
+};
+
+// A heterogeneous medium: density_scale times the grid's densities,
+// stretched over box. A 3D DDA walks the bricks along each ray and skips
+// the ones with a zero majorant. Inside the others, hit() samples a free
+// path by delta tracking and transmittance() estimates shadow rays by ratio
+// tracking, both against the brick's majorant.
+class grid_medium : public hittable {
+public:
+    grid_medium(std::shared_ptr<const voxel_grid> grid, const aabb& box, double density_scale, color albedo);
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        return false;
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override;
+
+    virtual bool has_media() const override { return true; }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        output_box = box;
+        return true;
+    }
+
+public:
+    std::shared_ptr<const voxel_grid> grid;
+    std::shared_ptr<material> phase_function;
+
+private:
+    aabb box;
+    vec3 voxels_per_unit;
+    double density_scale;
+
+    template <typename Segment>
+    void march(const ray& r, double t_min, double t_max, Segment&& segment) const;
+};
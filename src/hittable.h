@@ -2,26 +2,121 @@
 #include "ray.h"
 #include <memory>
 #include "aabb.h"
+#include "vec2.h"
+#include <cmath>
 
 class material;
+class hittable;
 
 struct hit_record {
     point3 p;
     vec3 normal;
-    std::shared_ptr<material> mat_ptr;
+    const material* mat_ptr = nullptr;  // non-owning
+    const hittable* object = nullptr;   // primitive hit, for light lookups
     double t;
     double u;
     double v;
     bool front_face;
 
+    // Partial derivatives of p and of the outward normal in (u, v). Shapes
+    // without a parameterization leave them zero, which turns off texture
+    // filtering at their hits.
+    vec3 dpdu, dpdv;
+    vec3 dndu, dndv;
+
+    // How p, u and v change from one pixel to the next in x and y, set by
+    // compute_differentials(); zero for rays without differentials.
+    vec3 dpdx, dpdy;
+    double dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
+
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    inline void set_partials(const vec3& pu, const vec3& pv, const vec3& nu, const vec3& nv) {
+        dpdu = pu;
+        dpdv = pv;
+        dndu = nu;
+        dndv = nv;
+    }
+
+    // Intersects r's offset rays with the tangent plane at p and solves for
+    // the matching (u, v) offsets in the least-squares sense.
+    inline void compute_differentials(const ray& r) {
+        dpdx = dpdy = vec3(0, 0, 0);
+        dudx = dvdx = dudy = dvdy = 0;
+        if (!r.has_differentials())
+            return;
+        const ray_differentials& d = r.differentials();
+        const double plane = dot(normal, p);
+        const double nx = dot(normal, d.rx_direction), ny = dot(normal, d.ry_direction);
+        if (std::fabs(nx) < 1e-12 || std::fabs(ny) < 1e-12)
+            return;
+        dpdx = d.rx_origin + ((plane - dot(normal, d.rx_origin)) / nx) * d.rx_direction - p;
+        dpdy = d.ry_origin + ((plane - dot(normal, d.ry_origin)) / ny) * d.ry_direction - p;
+
+        const double a00 = dot(dpdu, dpdu), a01 = dot(dpdu, dpdv), a11 = dot(dpdv, dpdv);
+        const double det = a00 * a11 - a01 * a01;
+        if (!(std::fabs(det) > 1e-20))
+            return;
+        const double bux = dot(dpdu, dpdx), bvx = dot(dpdv, dpdx);
+        const double buy = dot(dpdu, dpdy), bvy = dot(dpdv, dpdy);
+        dudx = (a11 * bux - a01 * bvx) / det;
+        dvdx = (a00 * bvx - a01 * bux) / det;
+        dudy = (a11 * buy - a01 * bvy) / det;
+        dvdy = (a00 * bvy - a01 * buy) / det;
+    }
+
+    // Width of the pixel's footprint in texture space (1 spans the texture).
+    inline double uv_footprint() const {
+        return 2 * std::fmax(std::fmax(std::fabs(dudx), std::fabs(dudy)),
+                             std::fmax(std::fabs(dvdx), std::fabs(dvdy)));
+    }
+
+    // Width of the footprint in world units.
+    inline double world_footprint() const {
+        return std::sqrt(std::fmax(dpdx.length_squared(), dpdy.length_squared()));
+    }
+
+    // Changes of the normal rec faces with, from pixel to pixel.
+    inline vec3 dndx() const { return (front_face ? 1 : -1) * (dndu * dudx + dndv * dvdx); }
+    inline vec3 dndy() const { return (front_face ? 1 : -1) * (dndu * dudy + dndv * dvdy); }
 };
 
 class hittable {
 public:
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
     virtual bool bounding_box(aabb& output_box) const = 0;
+
+    // Any-hit query for shadow rays: is anything in [t_min, t_max]? Overrides
+    // stop at the first hit and skip filling a hit_record.
+    virtual bool occluded(const ray& r, double t_min, double t_max) const {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
+
+    // Fraction of light let through along r in [t_min, t_max]. Participating
+    // media answer occluded() with false and attenuate shadow rays here
+    // instead; aggregates multiply in the media they hold.
+    virtual double transmittance(const ray& r, double t_min, double t_max) const { return 1.0; }
+
+    // Whether transmittance() can be below 1: true for media and for
+    // aggregates holding any, which lets the others skip the query.
+    virtual bool has_media() const { return false; }
+
+    // Area light support. random() picks a direction from origin toward the
+    // surface using u; pdf_value() is the solid-angle density of that choice
+    // for a given direction (0 if the direction misses). Primitives that
+    // cannot be sampled keep the defaults and are never used as lights.
+    virtual double pdf_value(const point3& origin, const vec3& direction) const { return 0.0; }
+    virtual vec3 random(const point3& origin, const vec2& u) const { return vec3(1, 0, 0); }
+
+    // Material and surface area of a single-surface primitive, or nullptr/0.
+    virtual const material* surface_material() const { return nullptr; }
+    virtual double area() const { return 0.0; }
+
+    // Cone (axis, cosine of half-angle) holding every outward normal of the
+    // surface, for orienting lights; false if unknown or unbounded.
+    virtual bool normal_bounds(vec3& axis, double& cos_theta) const { return false; }
 };
\ No newline at end of file
@@ -30,6 +30,31 @@ public:
         return hit_anything;
     }
 
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, t_min, t_max))
+                return true;
+        }
+        return false;
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        double result = 1.0;
+        for (const auto& object : objects) {
+            if (object->has_media())
+                result *= object->transmittance(r, t_min, t_max);
+        }
+        return result;
+    }
+
+    virtual bool has_media() const override {
+        for (const auto& object : objects) {
+            if (object->has_media())
+                return true;
+        }
+        return false;
+    }
+
     virtual bool bounding_box(aabb& output_box) const override {
         if (objects.empty()) return false;
     
@@ -0,0 +1,17 @@
+#pragma once
+#include "vec3.h"
+#include <vector>
+
+// Resolved linear radiance for a whole frame, stored row-major with the top
+// row first (the order image files use).
+struct image_buffer {
+    int width = 0;
+    int height = 0;
+    std::vector<color> pixels;
+
+    image_buffer() {}
+    image_buffer(int w, int h) : width(w), height(h), pixels(static_cast<size_t>(w) * h) {}
+
+    color& at(int x, int y) { return pixels[static_cast<size_t>(y) * width + x]; }
+    const color& at(int x, int y) const { return pixels[static_cast<size_t>(y) * width + x]; }
+};
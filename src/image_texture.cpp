@@ -0,0 +1,231 @@
+#include "image_texture.h"
+#include "binary_io.h"
+#include "color.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char magic[8] = { 'R', 'T', 'T', 'I', 'L', 'E', 'S', '1' };
+// Bump whenever the layout or the downsampling filter changes.
+const uint32_t format_version = 1;
+
+const size_t header_bytes = preamble_bytes + sizeof(uint32_t) + sizeof(uint64_t) + 2 * sizeof(int32_t);
+const size_t level_entry_bytes = 2 * sizeof(int32_t) + sizeof(uint64_t);
+const size_t tile_bytes = static_cast<size_t>(image_texture::tile_size) * image_texture::tile_size * 3;
+
+bool read_at(int fd, uint64_t offset, void* out, size_t bytes) {
+    return pread(fd, out, bytes, static_cast<off_t>(offset)) == static_cast<ssize_t>(bytes);
+}
+
+// 2x2 box filter; the last row or column of an odd-sized level is dropped.
+std::vector<unsigned char> downsample(const std::vector<unsigned char>& texels, int width, int height) {
+    const int w = std::max(1, width / 2), h = std::max(1, height / 2);
+    std::vector<unsigned char> out(static_cast<size_t>(w) * h * 3);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                int sum = 0;
+                for (int dy = 0; dy < 2; ++dy) {
+                    for (int dx = 0; dx < 2; ++dx) {
+                        const int sx = std::min(2 * x + dx, width - 1), sy = std::min(2 * y + dy, height - 1);
+                        sum += texels[(static_cast<size_t>(sy) * width + sx) * 3 + c];
+                    }
+                }
+                out[(static_cast<size_t>(y) * w + x) * 3 + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+image_texture::image_texture(const char* filename) : texture_id(texture_cache::global().register_texture()) {
+    const std::string image_path = filename;
+    const std::string path = image_path + ".tiles";
+    const uint64_t key = file_stat_key(image_path, format_version);
+    if (key == 0 || (!open_tiles(path, key) && !build_tiles(image_path, path, key))) {
+        std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
+        levels.clear();
+    }
+}
+
+image_texture::~image_texture() {
+    if (fd >= 0)
+        close(fd);
+}
+
+bool image_texture::open_tiles(const std::string& path, uint64_t key) {
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+
+    char header[header_bytes];
+    const char* cursor = header;
+    bool same_byte_order = false;
+    uint32_t version = 0;
+    uint64_t file_key = 0;
+    int32_t level_count = 0, file_tile_size = 0;
+    if (read_at(file, 0, header, header_bytes) && get_preamble(cursor, magic, same_byte_order)) {
+        get(cursor, version);
+        get(cursor, file_key);
+        get(cursor, level_count);
+        get(cursor, file_tile_size);
+    }
+    std::vector<char> table(level_count > 0 && level_count <= 32 ? level_count * level_entry_bytes : 0);
+    struct stat info;
+    if (!same_byte_order || version != format_version || file_key != key || file_tile_size != tile_size
+        || table.empty() || !read_at(file, header_bytes, table.data(), table.size()) || fstat(file, &info) != 0) {
+        close(file);
+        return false;
+    }
+
+    std::vector<mip_level> read_levels;
+    cursor = table.data();
+    for (int32_t l = 0; l < level_count; ++l) {
+        int32_t w, h;
+        uint64_t offset;
+        get(cursor, w);
+        get(cursor, h);
+        get(cursor, offset);
+        const int tiles_x = (w + tile_size - 1) / tile_size, tiles_y = (h + tile_size - 1) / tile_size;
+        read_levels.push_back({w, h, tiles_x, tiles_y, offset});
+    }
+    const mip_level& last = read_levels.back();
+    if (static_cast<uint64_t>(info.st_size) < last.offset + static_cast<uint64_t>(last.tiles_x) * last.tiles_y * tile_bytes) {
+        std::cerr << "Texture tiles " << path << " are truncated\n";
+        close(file);
+        return false;
+    }
+
+    levels.swap(read_levels);
+    fd = file;
+    return true;
+}
+
+bool image_texture::build_tiles(const std::string& image_path, const std::string& path, uint64_t key) {
+    int w, h, components;
+    unsigned char* data = stbi_load(image_path.c_str(), &w, &h, &components, 3);
+    if (!data)
+        return false;
+    std::vector<unsigned char> texels(data, data + static_cast<size_t>(w) * h * 3);
+    stbi_image_free(data);
+
+    std::vector<mip_level> built;
+    for (int lw = w, lh = h;; lw = std::max(1, lw / 2), lh = std::max(1, lh / 2)) {
+        built.push_back({lw, lh, (lw + tile_size - 1) / tile_size, (lh + tile_size - 1) / tile_size, 0});
+        if (lw == 1 && lh == 1)
+            break;
+    }
+
+    uint64_t offset = header_bytes + built.size() * level_entry_bytes;
+    for (auto& level : built) {
+        level.offset = offset;
+        offset += static_cast<uint64_t>(level.tiles_x) * level.tiles_y * tile_bytes;
+    }
+
+    std::string bytes;
+    bytes.reserve(offset);
+    put_preamble(bytes, magic);
+    put(bytes, format_version);
+    put(bytes, key);
+    put(bytes, static_cast<int32_t>(built.size()));
+    put(bytes, static_cast<int32_t>(tile_size));
+    for (const auto& level : built) {
+        put(bytes, static_cast<int32_t>(level.width));
+        put(bytes, static_cast<int32_t>(level.height));
+        put(bytes, level.offset);
+    }
+
+    // Texels past the image's right and bottom edges repeat the edge.
+    for (size_t l = 0; l < built.size(); ++l) {
+        const mip_level& level = built[l];
+        if (l > 0)
+            texels = downsample(texels, built[l - 1].width, built[l - 1].height);
+        for (int ty = 0; ty < level.tiles_y; ++ty) {
+            for (int tx = 0; tx < level.tiles_x; ++tx) {
+                for (int row = 0; row < tile_size; ++row) {
+                    const int y = std::min(ty * tile_size + row, level.height - 1);
+                    for (int col = 0; col < tile_size; ++col) {
+                        const int x = std::min(tx * tile_size + col, level.width - 1);
+                        bytes.append(reinterpret_cast<const char*>(&texels[(static_cast<size_t>(y) * level.width + x) * 3]), 3);
+                    }
+                }
+            }
+        }
+    }
+
+    if (write_file_atomically(path, bytes.data(), bytes.size()) && open_tiles(path, key))
+        return true;
+
+    // Keep the pyramid in memory instead; it is then outside the cache's budget.
+    std::cerr << "Could not write texture tiles " << path << "; keeping " << image_path << " in memory\n";
+    resident.assign(bytes.begin(), bytes.end());
+    levels.swap(built);
+    return true;
+}
+
+bool image_texture::load_tile(uint64_t key, texture_tile& texels) const {
+    const int level = static_cast<int>((key >> 32) & 0xff);
+    const int tile_y = static_cast<int>((key >> 16) & 0xffff);
+    const int tile_x = static_cast<int>(key & 0xffff);
+    const mip_level& l = levels[level];
+    const uint64_t offset = l.offset + (static_cast<uint64_t>(tile_y) * l.tiles_x + tile_x) * tile_bytes;
+    texels.resize(tile_bytes);
+    if (!resident.empty()) {
+        std::memcpy(texels.data(), resident.data() + offset, tile_bytes);
+        return true;
+    }
+    return read_at(fd, offset, texels.data(), tile_bytes);
+}
+
+color image_texture::bilinear(int level, double u, double v) const {
+    const mip_level& l = levels[level];
+    const double x = clamp(u, 0.0, 1.0) * l.width - 0.5;
+    const double y = (1.0 - clamp(v, 0.0, 1.0)) * l.height - 0.5;
+    const int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+    const double fx = x - x0, fy = y - y0;
+
+    texture_cache& cache = texture_cache::global();
+    uint64_t held_key = ~0ull;
+    texture_cache::tile_ptr held;
+    color result(0, 0, 0);
+    for (int dy = 0; dy < 2; ++dy) {
+        for (int dx = 0; dx < 2; ++dx) {
+            const int sx = std::min(std::max(x0 + dx, 0), l.width - 1);
+            const int sy = std::min(std::max(y0 + dy, 0), l.height - 1);
+            const uint64_t key = texture_cache::tile_key(texture_id, level, sx / tile_size, sy / tile_size);
+            if (key != held_key) {
+                held = cache.get(key, *this);
+                held_key = key;
+            }
+            if (!held)
+                return color(0, 1, 1);
+            const unsigned char* texel = held->data() + ((sy % tile_size) * tile_size + sx % tile_size) * 3;
+            const double weight = (dx ? fx : 1.0 - fx) * (dy ? fy : 1.0 - fy);
+            result += weight * color(texel[0], texel[1], texel[2]);
+        }
+    }
+    return result / 255.0;
+}
+
+color image_texture::sample(double u, double v, double width) const {
+    if (levels.empty())
+        return color(0, 1, 1);
+    const int last = level_count() - 1;
+    const double lod = width > 0 ? std::log2(width * std::max(levels[0].width, levels[0].height)) : 0.0;
+    if (lod <= 0)
+        return bilinear(0, u, v);
+    if (lod >= last)
+        return bilinear(last, u, v);
+    const int level = static_cast<int>(lod);
+    const double t = lod - level;
+    return (1 - t) * bilinear(level, u, v) + t * bilinear(level + 1, u, v);
+}
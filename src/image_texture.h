@@ -1,46 +1,57 @@
 #pragma once
 #include "texture.h"
+#include "texture_cache.h"
 #include "rtweekend.h"
-#include <iostream>
-#include "stb_image.h"
-
-class image_texture : public texture {
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// An 8-bit RGB image kept as a mip pyramid of 64x64 tiles. The pyramid is
+// built once and stored next to the image as FILE.tiles; renders read tiles
+// from there on demand through texture_cache::global(), so only the tiles
+// in use take memory. Lookups filter trilinearly between mip levels.
+class image_texture : public texture, private tile_loader {
 public:
-    const static int bytes_per_pixel = 3;
-
-    image_texture() : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
+    static const int tile_size = 64;
 
-    image_texture(const char* filename) {
-        int components_per_pixel;
-        data = stbi_load(filename, &width, &height, &components_per_pixel, bytes_per_pixel);
+    image_texture() {}
+    image_texture(const char* filename);
+    ~image_texture();
 
-        if (!data) {
-            std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
-            width = height = 0;
-        }
+    image_texture(const image_texture&) = delete;
+    image_texture& operator=(const image_texture&) = delete;
 
-        bytes_per_scanline = bytes_per_pixel * width;
+    virtual color value(double u, double v, const point3& p) const override {
+        return sample(u, v, 0.0);
     }
 
-    ~image_texture() {
-        if (data) stbi_image_free(data);
+    virtual color filtered_value(const hit_record& rec) const override {
+        return sample(rec.u, rec.v, rec.uv_footprint());
     }
 
-    virtual color value(double u, double v, const point3& p) const override {
-        if (!data) return color(0, 1, 1);
-        u = clamp(u, 0.0, 1.0);
-        v = 1.0 - clamp(v, 0.0, 1.0);
-        int i = static_cast<int>(u * width);
-        int j = static_cast<int>(v * height);
-        if (i >= width) i = width - 1;
-        if (j >= height) j = height - 1;
-        const double scale = 1.0 / 255.0;
-        unsigned char* pixel = data + j * bytes_per_scanline + i * bytes_per_pixel;
-        return color(scale * pixel[0], scale * pixel[1], scale * pixel[2]);
-    }
+    // Filtered lookup over a footprint width texture-space units across (1
+    // covers the whole image); 0 samples the full-resolution level.
+    color sample(double u, double v, double width) const;
+
+    int width() const { return levels.empty() ? 0 : levels[0].width; }
+    int height() const { return levels.empty() ? 0 : levels[0].height; }
+    int level_count() const { return static_cast<int>(levels.size()); }
 
 private:
-    unsigned char* data;
-    int width, height;
-    int bytes_per_scanline;
-};
\ No newline at end of file
+    struct mip_level {
+        int width, height;
+        int tiles_x, tiles_y;
+        uint64_t offset;   // of the level's first tile in the tile file
+    };
+
+    std::vector<mip_level> levels;
+    uint32_t texture_id = 0;
+    int fd = -1;                           // the tile file, read with pread
+    std::vector<unsigned char> resident;   // the tile file's bytes, when it could not be written
+
+    bool open_tiles(const std::string& path, uint64_t key);
+    bool build_tiles(const std::string& image_path, const std::string& path, uint64_t key);
+    virtual bool load_tile(uint64_t key, texture_tile& texels) const override;
+
+    color bilinear(int level, double u, double v) const;
+};
@@ -0,0 +1,192 @@
+#include "image_writer.h"
+#include "color.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+std::string header_for(const char* magic, const image_buffer& image, const char* extra) {
+    return std::string(magic) + "\n" + std::to_string(image.width) + " " + std::to_string(image.height)
+         + "\n" + extra + "\n";
+}
+
+bool host_is_little_endian() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+void to_rgbe(const color& c, unsigned char rgbe[4]) {
+    float r = std::max(0.0f, static_cast<float>(c.x()));
+    float g = std::max(0.0f, static_cast<float>(c.y()));
+    float b = std::max(0.0f, static_cast<float>(c.z()));
+    float v = std::max({r, g, b});
+    if (!(v >= 1e-32f)) {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+        return;
+    }
+    int e;
+    float m = std::frexp(v, &e) * 256.0f / v;
+    rgbe[0] = static_cast<unsigned char>(r * m);
+    rgbe[1] = static_cast<unsigned char>(g * m);
+    rgbe[2] = static_cast<unsigned char>(b * m);
+    rgbe[3] = static_cast<unsigned char>(e + 128);
+}
+
+// Run-length encodes one channel of a scanline: a byte above 128 is a run of
+// (byte - 128) copies of the next byte, otherwise it counts literal bytes.
+// Runs shorter than min_run are cheaper as literals.
+void rle_channel(const unsigned char* data, int n, std::string& out) {
+    const int min_run = 4;
+    int cur = 0;
+    while (cur < n) {
+        int run_start = cur;
+        int run_count = 0;
+        int prev_run_count = 0;
+        while (run_count < min_run && run_start < n) {
+            run_start += run_count;
+            prev_run_count = run_count;
+            run_count = 1;
+            while (run_start + run_count < n && run_count < 127
+                   && data[run_start + run_count] == data[run_start])
+                run_count++;
+        }
+
+        // A short run right before the long one still pays off as a run.
+        if (prev_run_count > 1 && prev_run_count == run_start - cur) {
+            out.push_back(static_cast<char>(128 + prev_run_count));
+            out.push_back(static_cast<char>(data[cur]));
+            cur = run_start;
+        }
+
+        while (cur < run_start) {
+            int literal = std::min(run_start - cur, 128);
+            out.push_back(static_cast<char>(literal));
+            out.append(reinterpret_cast<const char*>(data + cur), literal);
+            cur += literal;
+        }
+
+        if (run_count >= min_run) {
+            out.push_back(static_cast<char>(128 + run_count));
+            out.push_back(static_cast<char>(data[run_start]));
+            cur += run_count;
+        }
+    }
+}
+
+} // namespace
+
+bool image_writer::write(const std::string& path, const image_buffer& image) const {
+    std::string bytes = encode(image);
+    std::ofstream out(path, std::ios::binary);
+    if (!out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()))) {
+        std::cerr << "Could not write " << name() << " image to " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+std::string ppm_writer::encode(const image_buffer& image) const {
+    const std::string header = header_for("P6", image, "255");
+    const size_t row_bytes = static_cast<size_t>(image.width) * 3;
+    std::string bytes(header.size() + row_bytes * image.height, '\0');
+    std::memcpy(&bytes[0], header.data(), header.size());
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < image.height; ++y) {
+        char* row = &bytes[header.size() + row_bytes * y];
+        for (int x = 0; x < image.width; ++x) {
+            const color& c = image.at(x, y);
+            row[3 * x]     = static_cast<char>(to_byte(c.x()));
+            row[3 * x + 1] = static_cast<char>(to_byte(c.y()));
+            row[3 * x + 2] = static_cast<char>(to_byte(c.z()));
+        }
+    }
+    return bytes;
+}
+
+std::string pfm_writer::encode(const image_buffer& image) const {
+    // A negative scale marks little-endian data. Rows run bottom to top.
+    const std::string header = header_for("PF", image, host_is_little_endian() ? "-1.0" : "1.0");
+    const size_t row_bytes = static_cast<size_t>(image.width) * 3 * sizeof(float);
+    std::string bytes(header.size() + row_bytes * image.height, '\0');
+    std::memcpy(&bytes[0], header.data(), header.size());
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < image.height; ++y) {
+        std::vector<float> row(static_cast<size_t>(image.width) * 3);
+        for (int x = 0; x < image.width; ++x) {
+            const color& c = image.at(x, image.height - 1 - y);
+            row[3 * x]     = static_cast<float>(c.x());
+            row[3 * x + 1] = static_cast<float>(c.y());
+            row[3 * x + 2] = static_cast<float>(c.z());
+        }
+        std::memcpy(&bytes[header.size() + row_bytes * y], row.data(), row_bytes);
+    }
+    return bytes;
+}
+
+std::string hdr_writer::encode(const image_buffer& image) const {
+    std::string bytes = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(image.height)
+                      + " +X " + std::to_string(image.width) + "\n";
+
+    // The RLE scanline marker stores the width in 15 bits and readers only
+    // accept it from 8 pixels up.
+    const bool use_rle = image.width >= 8 && image.width < 32768;
+    std::vector<std::string> rows(image.height);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < image.height; ++y) {
+        std::vector<unsigned char> rgbe(static_cast<size_t>(image.width) * 4);
+        for (int x = 0; x < image.width; ++x)
+            to_rgbe(image.at(x, y), &rgbe[4 * x]);
+
+        std::string& row = rows[y];
+        if (!use_rle) {
+            row.assign(reinterpret_cast<const char*>(rgbe.data()), rgbe.size());
+            continue;
+        }
+
+        row.push_back(2);
+        row.push_back(2);
+        row.push_back(static_cast<char>(image.width >> 8));
+        row.push_back(static_cast<char>(image.width & 0xff));
+        std::vector<unsigned char> channel(image.width);
+        for (int k = 0; k < 4; ++k) {
+            for (int x = 0; x < image.width; ++x)
+                channel[x] = rgbe[4 * x + k];
+            rle_channel(channel.data(), image.width, row);
+        }
+    }
+
+    for (const auto& row : rows)
+        bytes += row;
+    return bytes;
+}
+
+std::unique_ptr<image_writer> make_image_writer(const std::string& path) {
+    const size_t dot = path.find_last_of('.');
+    std::string ext = dot == std::string::npos ? "" : path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    if (ext == ".ppm") return std::make_unique<ppm_writer>();
+    if (ext == ".pfm") return std::make_unique<pfm_writer>();
+    if (ext == ".hdr") return std::make_unique<hdr_writer>();
+    return nullptr;
+}
+
+bool write_image(const std::string& path, const image_buffer& image) {
+    auto writer = make_image_writer(path);
+    if (!writer) {
+        std::cerr << "Unknown image format for " << path << " (expected .ppm, .pfm or .hdr)\n";
+        return false;
+    }
+    return writer->write(path, image);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "image_buffer.h"
+#include <memory>
+#include <string>
+
+// One output format. encode() turns the frame into the complete file
+// contents; rows are encoded in parallel where the format allows it.
+class image_writer {
+public:
+    virtual ~image_writer() {}
+    virtual std::string encode(const image_buffer& image) const = 0;
+    virtual const char* name() const = 0;
+
+    // Encodes and writes the file in one go. Returns false (after reporting
+    // on std::cerr) if the file could not be written.
+    bool write(const std::string& path, const image_buffer& image) const;
+};
+
+// Binary P6 PPM, gamma 2 and clamped to 8 bits like write_color.
+class ppm_writer : public image_writer {
+public:
+    virtual std::string encode(const image_buffer& image) const override;
+    virtual const char* name() const override { return "PPM (P6)"; }
+};
+
+// Portable float map: unclamped linear RGB as 32-bit floats.
+class pfm_writer : public image_writer {
+public:
+    virtual std::string encode(const image_buffer& image) const override;
+    virtual const char* name() const override { return "PFM"; }
+};
+
+// Radiance RGBE with per-scanline run-length encoding (flat scanlines where
+// the format does not allow RLE).
+class hdr_writer : public image_writer {
+public:
+    virtual std::string encode(const image_buffer& image) const override;
+    virtual const char* name() const override { return "Radiance HDR"; }
+};
+
+// Picks a writer from the file extension (.ppm, .pfm, .hdr). Returns nullptr
+// for anything else.
+std::unique_ptr<image_writer> make_image_writer(const std::string& path);
+
+// Convenience wrapper: chooses the writer from path and writes the image.
+bool write_image(const std::string& path, const image_buffer& image);
@@ -0,0 +1,139 @@
+#pragma once
+#include "hittable.h"
+#include "hittable_list.h"
+#include "transform.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include <memory>
+
+// Builds the bottom-level structure for an object group once; any number of
+// instances can then share it.
+inline std::shared_ptr<hittable> make_blas(const hittable_list& group,
+                                           const bvh_build_options& options = bvh_build_options()) {
+    return std::make_shared<linear_bvh>(group, options);
+}
+
+// Places shared geometry (a BLAS, a mesh or a single primitive) in the world
+// with a full affine transform. Rays are moved into object space instead of
+// copying the geometry, so each copy costs only the two matrices.
+class instance : public hittable {
+public:
+    instance(std::shared_ptr<hittable> geometry, const affine_transform& object_to_world)
+        : blas(geometry) {
+        set_transform(object_to_world);
+    }
+
+    void set_transform(const affine_transform& object_to_world) {
+        to_world = object_to_world;
+        to_object = object_to_world.inverse();
+    }
+
+    const affine_transform& transform() const { return to_world; }
+    const std::shared_ptr<hittable>& geometry() const { return blas; }
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        // The direction is not renormalized, so t means the same in both spaces.
+        ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+        if (!blas->hit(local, t_min, t_max, rec))
+            return false;
+
+        vec3 outward = rec.front_face ? rec.normal : -rec.normal;
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, unit_vector(to_object.apply_transposed(outward)));
+        rec.set_partials(to_world.apply_vector(rec.dpdu), to_world.apply_vector(rec.dpdv),
+                         to_object.apply_transposed(rec.dndu), to_object.apply_transposed(rec.dndv));
+        rec.object = this;  // the inner primitive's light sampling is in object space
+        return true;
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+        return blas->occluded(local, t_min, t_max);
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+        return blas->transmittance(local, t_min, t_max);
+    }
+
+    virtual bool has_media() const override { return blas->has_media(); }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        aabb local;
+        if (!blas->bounding_box(local))
+            return false;
+
+        point3 lo(infinity, infinity, infinity);
+        point3 hi(-infinity, -infinity, -infinity);
+        for (int corner = 0; corner < 8; ++corner) {
+            point3 p((corner & 1) ? local.max().x() : local.min().x(),
+                     (corner & 2) ? local.max().y() : local.min().y(),
+                     (corner & 4) ? local.max().z() : local.min().z());
+            point3 w = to_world.apply_point(p);
+            for (int a = 0; a < 3; ++a) {
+                lo[a] = fmin(lo[a], w[a]);
+                hi[a] = fmax(hi[a], w[a]);
+            }
+        }
+        output_box = aabb(lo, hi);
+        return true;
+    }
+
+private:
+    std::shared_ptr<hittable> blas;
+    affine_transform to_world;
+    affine_transform to_object;
+};
+
+// Top-level acceleration structure over instances (and any other hittables).
+// Bottom-level structures are built once; rebuild() only re-sorts the
+// top-level entries, e.g. after moving instances between frames.
+class tlas : public hittable {
+public:
+    tlas() {}
+
+    tlas(const hittable_list& list, const bvh_build_options& options = bvh_build_options())
+        : objects(list) {
+        rebuild(options);
+    }
+
+    void add(std::shared_ptr<hittable> object) { objects.add(object); }
+
+    void rebuild(const bvh_build_options& options = bvh_build_options()) {
+        accel.reset();
+        if (objects.objects.empty())
+            return;
+        bvh_node tree(objects, options);
+        cost = tree.sah_cost(options);
+        accel = std::make_unique<wide_bvh>(tree);
+    }
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        return accel && accel->hit(r, t_min, t_max, rec);
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        return accel && accel->occluded(r, t_min, t_max);
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        return accel ? accel->transmittance(r, t_min, t_max) : 1.0;
+    }
+
+    virtual bool has_media() const override { return accel && accel->has_media(); }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        return accel && accel->bounding_box(output_box);
+    }
+
+    double sah_cost() const { return cost; }
+    const wide_bvh& accelerator() const { return *accel; }
+
+public:
+    hittable_list objects;
+
+private:
+    std::unique_ptr<wide_bvh> accel;
+    double cost = 0;
+};
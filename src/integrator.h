@@ -0,0 +1,171 @@
+#pragma once
+#include "hittable.h"
+#include "light_list.h"
+#include "material.h"
+#include "sampler.h"
+#include "rtweekend.h"
+#include <algorithm>
+#include <cstdint>
+
+struct path_stats {
+    uint64_t paths = 0;
+    uint64_t bounces = 0;
+    uint64_t roulette_terminated = 0;
+};
+
+// Sampler dimensions: the pixel jitter and camera take the first
+// camera_dimensions, then every bounce owns a block of bounce_dimensions laid
+// out as [material scatter (up to 3) | light choice (1) | light point (2) |
+// roulette (1)].
+const int camera_dimensions = 5;
+const int bounce_dimensions = 7;
+
+// Denoiser guides for one camera ray. Specular bounces are followed to the
+// first diffuse surface, emitter or the sky, so mirrors and glass carry the
+// guides of what they show; the sky keeps a zero normal.
+struct first_hit {
+    color albedo = color(1, 1, 1);
+    vec3 normal = vec3(0, 0, 0);
+    double depth = 0;
+};
+
+inline double power_heuristic(double pdf_a, double pdf_b) {
+    double a = pdf_a * pdf_a;
+    double b = pdf_b * pdf_b;
+    return a + b > 0 ? a / (a + b) : 0.0;
+}
+
+// Normal that light selection may use to skip lights behind rec. Materials
+// that also scatter through the back (media) get none.
+inline vec3 light_selection_normal(const ray& r, const hit_record& rec) {
+    return rec.mat_ptr->scattering_pdf(r, rec, -rec.normal) > 0 ? vec3(0, 0, 0) : rec.normal;
+}
+
+// Direct light at rec from one light chosen from lights, weighted against the
+// material's own sampling of the same direction (multiple importance
+// sampling with the power heuristic). Media do not block the shadow ray;
+// they attenuate it by their transmittance instead.
+inline color sample_direct_light(const ray& r, const hit_record& rec, const vec3& selection_normal,
+                                 const hittable& world, const light_list& lights, sampler& samp) {
+    double pick_pmf;
+    const hittable* light = lights.sample(rec.p, selection_normal, samp.get_1d(), pick_pmf);
+    if (!light)
+        return color(0, 0, 0);
+    vec3 direction = light->random(rec.p, samp.get_2d());
+    double light_pdf = pick_pmf * light->pdf_value(rec.p, direction);
+    if (light_pdf <= 0)
+        return color(0, 0, 0);
+
+    color f = rec.mat_ptr->eval(r, rec, direction);
+    if (f.near_zero())
+        return color(0, 0, 0);
+
+    ray shadow_ray(rec.p, direction, r.time());
+    hit_record light_rec;
+    if (!light->hit(shadow_ray, 0.001, infinity, light_rec))
+        return color(0, 0, 0);
+    if (world.occluded(shadow_ray, 0.001, light_rec.t * (1.0 - 1e-6)))
+        return color(0, 0, 0);
+    const double visible = world.transmittance(shadow_ray, 0.001, light_rec.t);
+    if (visible <= 0)
+        return color(0, 0, 0);
+
+    double weight = power_heuristic(light_pdf, rec.mat_ptr->scattering_pdf(r, rec, direction));
+    return f * light_rec.mat_ptr->emitted(light_rec) * (visible * weight / light_pdf);
+}
+
+inline color ray_color(const ray& r_in, const hittable& world, const light_list& lights,
+                       int max_depth, int rr_min_depth, sampler& samp, path_stats& stats,
+                       first_hit* guide = nullptr) {
+    color radiance(0, 0, 0);
+    color throughput(1, 1, 1);
+    ray r = r_in;
+    stats.paths++;
+
+    // How the current ray was generated, for weighting emitters it hits.
+    bool from_specular = true;
+    double scatter_pdf = 0;
+    point3 scatter_origin;
+    vec3 scatter_normal;
+
+    color guide_tint(1, 1, 1);
+    double path_length = 0;
+    auto record_guide = [&](const hit_record& rec) {
+        guide->albedo = guide_tint * rec.mat_ptr->reflectance(rec);
+        guide->normal = rec.normal;
+        guide->depth = path_length;
+        guide = nullptr;
+    };
+
+    for (int depth = 0; depth < max_depth; ++depth) {
+        hit_record rec;
+        if (!world.hit(r, 0.001, infinity, rec)) {
+            vec3 unit_dir = unit_vector(r.direction());
+            double t = 0.5 * (unit_dir.y() + 1.0);
+            radiance += throughput * ((1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0));
+            if (guide)
+                guide->albedo = guide_tint;
+            break;
+        }
+        stats.bounces++;
+        rec.compute_differentials(r);
+        path_length += rec.t * r.direction().length();
+        const int bounce_base = camera_dimensions + depth * bounce_dimensions;
+        samp.set_dimension(bounce_base);
+
+        // Emitters that light sampling could also have picked get the MIS
+        // weight; everything else counts in full.
+        color emitted = rec.mat_ptr->emitted(rec);
+        if (!emitted.near_zero()) {
+            double light_pmf = from_specular ? 0.0 : lights.pmf(scatter_origin, scatter_normal, rec.object);
+            double weight = 1.0;
+            if (light_pmf > 0) {
+                double light_pdf = light_pmf * rec.object->pdf_value(scatter_origin, r.direction());
+                weight = power_heuristic(scatter_pdf, light_pdf);
+            }
+            radiance += throughput * emitted * weight;
+        }
+
+        ray scattered;
+        color attenuation;
+        const bool scatters = rec.mat_ptr->scatter(r, rec, attenuation, scattered, samp);
+        if (guide) {
+            if (!scatters || !emitted.near_zero() || !rec.mat_ptr->is_specular())
+                record_guide(rec);
+            else
+                guide_tint = guide_tint * attenuation;
+        }
+        if (!scatters)
+            break;
+
+        from_specular = rec.mat_ptr->is_specular();
+        if (!from_specular) {
+            scatter_normal = light_selection_normal(r, rec);
+            if (!lights.empty()) {
+                samp.set_dimension(bounce_base + 3);
+                radiance += throughput * sample_direct_light(r, rec, scatter_normal, world, lights, samp);
+            }
+        }
+
+        scatter_pdf = from_specular ? 0.0 : rec.mat_ptr->scattering_pdf(r, rec, scattered.direction());
+        scatter_origin = rec.p;
+        throughput = throughput * attenuation;
+
+        // Russian roulette: past the minimum depth, continue with probability
+        // equal to the path's remaining throughput and reweight survivors, so
+        // the estimate stays unbiased while dim paths stop early.
+        if (depth + 1 >= rr_min_depth) {
+            double survive = std::min(0.95, std::max({throughput.x(), throughput.y(), throughput.z()}));
+            samp.set_dimension(bounce_base + 6);
+            if (samp.get_1d() >= survive) {
+                stats.roulette_terminated++;
+                break;
+            }
+            throughput /= survive;
+        }
+
+        r = scattered;
+    }
+
+    return radiance;
+}
@@ -4,24 +4,6 @@
 #include "solid_color.h"
 #include "rtweekend.h"
 
-inline vec3 random_cosine_direction() {
-    double r1 = random_double();
-    double r2 = random_double();
-    double z = sqrt(1.0 - r2);
-    
-    double phi = 2.0 * pi * r1;
-    double x = cos(phi) * sqrt(r2);
-    double y = sin(phi) * sqrt(r2);
-    
-    return vec3(x, y, z);
-}
-
-inline void onb_from_w(const vec3& w, vec3& u, vec3& v) {
-    vec3 a = (fabs(w.x()) > 0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
-    v = unit_vector(cross(w, a));
-    u = cross(w, v);
-}
-
 class lambertian : public material {
 public:
     lambertian(const color& c) {
@@ -36,13 +18,14 @@ public:
         const ray& r_in,             
         const hit_record& rec,      
         color& attenuation,          
-        ray& scattered               
+        ray& scattered,
+        sampler& samp
     ) const override 
     {
         vec3 u, v;
         onb_from_w(rec.normal, u, v);
         
-        vec3 local_dir = random_cosine_direction();
+        vec3 local_dir = sample_cosine_hemisphere(samp.get_2d());
         
         vec3 scatter_direction = local_dir.x() * u + 
                                  local_dir.y() * v + 
@@ -53,11 +36,27 @@ public:
         }
 
         scattered = ray(rec.p, unit_vector(scatter_direction));
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
+        set_diffuse_differentials(r_in, rec, scattered);
+        attenuation = albedo->filtered_value(rec);
 
         return true;
     }
 
+    virtual bool is_specular() const override { return false; }
+
+    virtual color reflectance(const hit_record& rec) const override {
+        return albedo->filtered_value(rec);
+    }
+
+    virtual color eval(const ray& r_in, const hit_record& rec, const vec3& wi) const override {
+        return albedo->filtered_value(rec) * scattering_pdf(r_in, rec, wi);
+    }
+
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const override {
+        double cosine = dot(rec.normal, unit_vector(wi));
+        return cosine > 0 ? cosine / pi : 0.0;
+    }
+
 private:
     std::shared_ptr<texture> albedo;
 };
\ No newline at end of file
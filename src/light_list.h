@@ -0,0 +1,379 @@
+#pragma once
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "rtweekend.h"
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Spatial, orientation and power bounds of a light or a cluster of lights
+// (Conty Estevez and Kulla 2018). Every emitting normal lies within
+// acos(cos_theta_o) of w, and each surface point emits within
+// acos(cos_theta_e) of its normal (90 degrees for a diffuse emitter).
+// Two-sided lights emit around both w and -w.
+struct light_bounds {
+    aabb box;
+    double phi = 0;
+    vec3 w = vec3(0, 0, 1);
+    double cos_theta_o = -1;
+    double cos_theta_e = 0;
+    bool two_sided = false;
+
+    // Conservative estimate of the light reaching p; n is the normal at p, or
+    // zero when light is received from every direction (participating media).
+    // It is zero only where the bounded lights cannot contribute.
+    double importance(const point3& p, const vec3& n) const {
+        const point3 pc = box.centroid();
+        const double distance_squared = (p - pc).length_squared();
+        const double d2 = std::fmax(distance_squared, 0.5 * (box.max() - box.min()).length());
+        const vec3 wi = distance_squared > 0 ? (p - pc) / std::sqrt(distance_squared) : w;
+
+        double cos_theta_w = dot(w, wi);
+        if (two_sided)
+            cos_theta_w = std::fabs(cos_theta_w);
+        const double sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+
+        // Half-angle of the cone of directions from p toward the box.
+        const double cos_theta_b = cos_subtended(p);
+        const double sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+        // Smallest angle between wi and an emitting normal, then between the
+        // normal and any direction toward p: max(0, theta_w - theta_o - theta_b).
+        const double sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+        const double cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        const double sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        const double cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p <= cos_theta_e)
+            return 0.0;
+
+        double importance = phi * cos_theta_p / d2;
+        if (n.length_squared() > 0) {
+            const double cos_theta_i = std::fabs(dot(wi, n));
+            const double sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+            importance *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+        }
+        return std::fmax(importance, 0.0);
+    }
+
+    static double safe_sqrt(double x) { return std::sqrt(std::fmax(0.0, x)); }
+
+    // cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines.
+    static double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        return cos_a > cos_b ? 1.0 : cos_a * cos_b + sin_a * sin_b;
+    }
+    static double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        return cos_a > cos_b ? 0.0 : sin_a * cos_b - cos_a * sin_b;
+    }
+
+private:
+    double cos_subtended(const point3& p) const {
+        const point3 c = box.centroid();
+        const double r2 = (box.max() - c).length_squared();
+        const double d2 = (p - c).length_squared();
+        if (d2 <= r2)
+            return -1.0;
+        return safe_sqrt(1 - r2 / d2);
+    }
+};
+
+// Smallest cone (approximately) holding both cones' directions.
+inline void union_cone(const vec3& wa, double cos_a, const vec3& wb, double cos_b, vec3& w, double& cos_theta) {
+    const double theta_a = std::acos(clamp(cos_a, -1, 1));
+    const double theta_b = std::acos(clamp(cos_b, -1, 1));
+    const double theta_d = std::acos(clamp(dot(wa, wb), -1, 1));
+    if (std::fmin(theta_d + theta_b, pi) <= theta_a) {
+        w = wa;
+        cos_theta = cos_a;
+        return;
+    }
+    if (std::fmin(theta_d + theta_a, pi) <= theta_b) {
+        w = wb;
+        cos_theta = cos_b;
+        return;
+    }
+
+    const double theta_o = 0.5 * (theta_a + theta_d + theta_b);
+    const vec3 axis = cross(wa, wb);
+    if (theta_o >= pi || axis.length_squared() == 0) {
+        w = wa;
+        cos_theta = -1;
+        return;
+    }
+
+    // Rotate wa toward wb by theta_o - theta_a (Rodrigues' formula).
+    const vec3 k = unit_vector(axis);
+    const double theta_r = theta_o - theta_a;
+    w = unit_vector(wa * std::cos(theta_r) + cross(k, wa) * std::sin(theta_r)
+                    + k * dot(k, wa) * (1 - std::cos(theta_r)));
+    cos_theta = std::cos(theta_o);
+}
+
+inline light_bounds union_bounds(const light_bounds& a, const light_bounds& b) {
+    if (a.phi == 0) return b;
+    if (b.phi == 0) return a;
+    light_bounds result;
+    result.box = surrounding_box(a.box, b.box);
+    result.phi = a.phi + b.phi;
+    union_cone(a.w, a.cos_theta_o, b.w, b.cos_theta_o, result.w, result.cos_theta_o);
+    result.cos_theta_e = std::fmin(a.cos_theta_e, b.cos_theta_e);
+    result.two_sided = a.two_sided || b.two_sided;
+    return result;
+}
+
+// Every emitting primitive of a scene that can be sampled by area, organised
+// in a light BVH. A light is chosen for a shading point by walking the tree
+// and picking each child in proportion to its importance (power, distance
+// and orientation toward the point), so in a scene with thousands of small
+// emitters the nearby, facing ones take most samples, in O(log n).
+class light_list {
+public:
+    light_list() {}
+
+    // Collects lights from the top level of world (nested lists included).
+    // Emitters inside instances or other wrappers are not sampled directly;
+    // they are still found by scattered rays.
+    explicit light_list(const hittable_list& world) {
+        collect(world);
+        if (lights.empty())
+            return;
+
+        std::vector<uint32_t> order(lights.size());
+        for (uint32_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        nodes.reserve(2 * lights.size() - 1);
+        build(order, 0, order.size(), 0, 0);
+    }
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    // Picks a light for shading point p with normal n (zero for media) with
+    // u in [0, 1); pmf receives its selection probability. Returns nullptr
+    // when no light can reach p.
+    const hittable* sample(const point3& p, const vec3& n, double u, double& pmf) const {
+        pmf = 0;
+        if (nodes.empty())
+            return nullptr;
+
+        double probability = 1.0;
+        uint32_t index = 0;
+        while (!nodes[index].leaf) {
+            const uint32_t first = index + 1;
+            const uint32_t second = nodes[index].offset;
+            const double importance_first = nodes[first].bounds.importance(p, n);
+            const double importance_second = nodes[second].bounds.importance(p, n);
+            const double total = importance_first + importance_second;
+            if (total <= 0)
+                return nullptr;
+
+            const double p_first = importance_first / total;
+            if (u < p_first) {
+                index = first;
+                u = std::min(u / p_first, one_minus_epsilon);
+                probability *= p_first;
+            } else {
+                index = second;
+                u = std::min((u - p_first) / (1 - p_first), one_minus_epsilon);
+                probability *= 1 - p_first;
+            }
+        }
+
+        if (nodes[index].bounds.importance(p, n) <= 0)
+            return nullptr;
+        pmf = probability;
+        return lights[nodes[index].offset];
+    }
+
+    // Probability of sample(p, n, ...) returning object; 0 for anything that
+    // is not a light.
+    double pmf(const point3& p, const vec3& n, const hittable* object) const {
+        auto found = trails.find(object);
+        if (found == trails.end())
+            return 0.0;
+
+        // The trail holds the branch taken at each level, root first.
+        uint64_t trail = found->second;
+        double probability = 1.0;
+        uint32_t index = 0;
+        while (!nodes[index].leaf) {
+            const uint32_t first = index + 1;
+            const uint32_t second = nodes[index].offset;
+            const double importance_first = nodes[first].bounds.importance(p, n);
+            const double importance_second = nodes[second].bounds.importance(p, n);
+            const double total = importance_first + importance_second;
+            if (total <= 0)
+                return 0.0;
+
+            if (trail & 1) {
+                probability *= importance_second / total;
+                index = second;
+            } else {
+                probability *= importance_first / total;
+                index = first;
+            }
+            trail >>= 1;
+        }
+        return nodes[index].bounds.importance(p, n) > 0 ? probability : 0.0;
+    }
+
+private:
+    // Interior nodes keep their first child right after them and the
+    // second at offset; leaves hold a single light, lights[offset].
+    struct node {
+        light_bounds bounds;
+        uint32_t offset;
+        bool leaf;
+    };
+
+    static constexpr double one_minus_epsilon = 0x1.fffffffffffffp-1;
+    static const int bin_count = 12;
+    // Binned splits stop at this depth so that the median splits below it
+    // keep every trail within its 64 bits.
+    static const int max_binned_depth = 32;
+
+    std::vector<const hittable*> lights;
+    std::vector<light_bounds> bounds;
+    std::vector<node> nodes;
+    std::unordered_map<const hittable*, uint64_t> trails;
+
+    void collect(const hittable_list& list) {
+        for (const auto& object : list.objects) {
+            if (auto nested = dynamic_cast<const hittable_list*>(object.get())) {
+                collect(*nested);
+                continue;
+            }
+            const material* m = object->surface_material();
+            aabb box;
+            if (!m || object->area() <= 0.0 || !object->bounding_box(box))
+                continue;
+
+            // Probe the material from either side of the surface.
+            hit_record front, back;
+            front.front_face = true;
+            back.front_face = false;
+            const double front_luminance = luminance(m->emitted(front));
+            const double back_luminance = luminance(m->emitted(back));
+            if (front_luminance <= 0.0 && back_luminance <= 0.0)
+                continue;
+
+            light_bounds b;
+            b.box = box;
+            b.phi = pi * object->area() * (front_luminance + back_luminance);
+            b.two_sided = front_luminance > 0.0 && back_luminance > 0.0;
+            if (!object->normal_bounds(b.w, b.cos_theta_o)) {
+                b.w = vec3(0, 0, 1);
+                b.cos_theta_o = -1;
+            } else if (front_luminance <= 0.0) {
+                b.w = -b.w;
+            }
+            lights.push_back(object.get());
+            bounds.push_back(b);
+        }
+    }
+
+    static double luminance(const color& c) {
+        return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+    }
+
+    // Cost of a cluster: power times the solid angle measure of its
+    // orientation bounds times its surface area, with a penalty for thin
+    // splits along the short axes of the parent (Kr).
+    static double cluster_cost(const light_bounds& b, double kr) {
+        const double theta_o = std::acos(clamp(b.cos_theta_o, -1, 1));
+        const double theta_e = std::acos(clamp(b.cos_theta_e, -1, 1));
+        const double theta_w = std::fmin(theta_o + theta_e, pi);
+        const double sin_theta_o = std::sin(theta_o);
+        const double m_omega = 2 * pi * (1 - b.cos_theta_o)
+            + pi / 2 * (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w)
+                        - 2 * theta_o * sin_theta_o + b.cos_theta_o);
+        return b.phi * m_omega * kr * b.box.surface_area();
+    }
+
+    uint32_t build(std::vector<uint32_t>& order, size_t start, size_t end, uint64_t trail, int depth) {
+        const uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(node());
+
+        if (end - start == 1) {
+            const uint32_t light = order[start];
+            nodes[index] = { bounds[light], light, true };
+            trails[lights[light]] = trail;
+            return index;
+        }
+
+        light_bounds all;
+        aabb centroids(bounds[order[start]].box.centroid(), bounds[order[start]].box.centroid());
+        for (size_t i = start; i < end; ++i) {
+            all = union_bounds(all, bounds[order[i]]);
+            const point3 c = bounds[order[i]].box.centroid();
+            centroids = surrounding_box(centroids, aabb(c, c));
+        }
+
+        // Binned split over all three axes; coincident lights and deep
+        // subtrees fall back to a median split.
+        size_t mid = start + (end - start) / 2;
+        int best_axis = -1;
+        int best_bin = 0;
+        double best_cost = infinity;
+        const vec3 extent = all.box.max() - all.box.min();
+        const double max_extent = std::fmax(extent.x(), std::fmax(extent.y(), extent.z()));
+        if (depth < max_binned_depth) {
+            for (int axis = 0; axis < 3; ++axis) {
+                const double lo = centroids.min()[axis];
+                const double hi = centroids.max()[axis];
+                if (hi <= lo)
+                    continue;
+
+                light_bounds bins[bin_count];
+                for (size_t i = start; i < end; ++i) {
+                    const double c = bounds[order[i]].box.centroid()[axis];
+                    const int b = std::min(bin_count - 1, static_cast<int>(bin_count * (c - lo) / (hi - lo)));
+                    bins[b] = union_bounds(bins[b], bounds[order[i]]);
+                }
+
+                light_bounds below[bin_count];
+                below[0] = bins[0];
+                for (int b = 1; b < bin_count; ++b)
+                    below[b] = union_bounds(below[b - 1], bins[b]);
+
+                const double kr = extent[axis] > 0 ? max_extent / extent[axis] : 1.0;
+                light_bounds above;
+                for (int b = bin_count - 1; b > 0; --b) {
+                    above = union_bounds(above, bins[b]);
+                    if (below[b - 1].phi == 0 || above.phi == 0)
+                        continue;
+                    const double cost = cluster_cost(below[b - 1], kr) + cluster_cost(above, kr);
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = b;
+                    }
+                }
+            }
+        }
+
+        if (best_axis >= 0) {
+            const double lo = centroids.min()[best_axis];
+            const double hi = centroids.max()[best_axis];
+            auto split = std::partition(order.begin() + start, order.begin() + end, [&](uint32_t light) {
+                const double c = bounds[light].box.centroid()[best_axis];
+                return std::min(bin_count - 1, static_cast<int>(bin_count * (c - lo) / (hi - lo))) < best_bin;
+            });
+            mid = split - order.begin();
+        }
+        if (mid == start || mid == end) {
+            mid = start + (end - start) / 2;
+            const int axis = centroids.longest_axis();
+            std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                             [&](uint32_t a, uint32_t b) {
+                                 return bounds[a].box.centroid()[axis] < bounds[b].box.centroid()[axis];
+                             });
+        }
+
+        build(order, start, mid, trail, depth + 1);
+        const uint32_t second = build(order, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+        nodes[index] = { all, second, false };
+        return index;
+    }
+};
@@ -0,0 +1,306 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// One node of a flattened BVH. Nodes are stored depth-first, so an interior
+// node's first child always follows it directly and only the second child's
+// index is stored. Leaves reference a contiguous range of primitives.
+struct linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset;       // leaf: first primitive, interior: second child
+    uint16_t prim_count;   // 0 for interior nodes
+    uint8_t axis;
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+const int linear_bvh_max_depth = 64;
+
+// Leaves count their primitives in 16 bits. A range still larger than that
+// at the depth limit is split further, into spare stack levels: 17 halvings
+// bring even 2^32 primitives down to one leaf's worth.
+const size_t linear_bvh_max_leaf_size = 65535;
+const int linear_bvh_stack_size = linear_bvh_max_depth + 17;
+
+inline float round_down(double x) {
+    float f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float round_up(double x) {
+    float f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+inline void set_node_bounds(linear_bvh_node& node, const aabb& box) {
+    for (int a = 0; a < 3; ++a) {
+        node.bounds_min[a] = round_down(box.min()[a]);
+        node.bounds_max[a] = round_up(box.max()[a]);
+    }
+}
+
+inline bool linear_bvh_node_hit(const linear_bvh_node& node, const point3& origin, const vec3& inv_dir,
+                                double t_min, double t_max) {
+    for (int a = 0; a < 3; ++a) {
+        double t0 = (node.bounds_min[a] - origin[a]) * inv_dir[a];
+        double t1 = (node.bounds_max[a] - origin[a]) * inv_dir[a];
+        if (inv_dir[a] < 0.0)
+            std::swap(t0, t1);
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_max < t_min)
+            return false;
+    }
+    return true;
+}
+
+// Walks a flattened BVH with an explicit stack, visiting the child on the
+// near side of each split first. intersect_leaf(first, count, t_max) tests one
+// leaf's primitives, shrinking t_max on a hit, and returns whether it hit.
+// With AnyHit set the walk stops at the first leaf that reports a hit.
+template <bool AnyHit = false, typename LeafFn>
+inline bool traverse_linear_bvh(const linear_bvh_node* nodes, const ray& r, double t_min, double t_max,
+                                LeafFn&& intersect_leaf) {
+    const point3 origin = r.origin();
+    const vec3 dir = r.direction();
+    const vec3 inv_dir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+    const bool dir_is_neg[3] = { inv_dir.x() < 0.0, inv_dir.y() < 0.0, inv_dir.z() < 0.0 };
+
+    uint32_t stack[linear_bvh_stack_size];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const linear_bvh_node& node = nodes[current];
+        if (linear_bvh_node_hit(node, origin, inv_dir, t_min, t_max)) {
+            if (node.prim_count > 0) {
+                if (intersect_leaf(node.offset, node.prim_count, t_max)) {
+                    if (AnyHit) return true;
+                    hit_anything = true;
+                }
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            } else if (dir_is_neg[node.axis]) {
+                stack[stack_size++] = current + 1;
+                current = node.offset;
+            } else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        } else {
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+    }
+
+    return hit_anything;
+}
+
+// Builds the subtree over prims[start, end) onto the end of nodes and
+// returns its root. A left subtree large enough to build as its own task
+// goes into a separate vector and is spliced in afterwards, with its interior
+// offsets moved, so the layout matches a serial build.
+inline uint32_t build_linear_subtree(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                                     const bvh_build_options& options, std::vector<linear_bvh_node>& nodes,
+                                     int depth) {
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    const range_bounds bounds = bounds_of_range(prims, start, end);
+    set_node_bounds(nodes[index], bounds.box);
+
+    bvh_split split = { true, end, 0 };
+    if (depth < linear_bvh_max_depth - 1)
+        split = partition_primitives(prims, start, end, bounds, options);
+    else if (end - start > linear_bvh_max_leaf_size)
+        split = median_split(prims, start, end, bounds.centroids.longest_axis());
+
+    if (split.make_leaf) {
+        nodes[index].offset = static_cast<uint32_t>(start);
+        nodes[index].prim_count = static_cast<uint16_t>(end - start);
+        nodes[index].axis = 0;
+        return index;
+    }
+
+    nodes[index].prim_count = 0;
+    nodes[index].axis = static_cast<uint8_t>(split.axis);
+    if (split.mid - start < bvh_parallel_threshold) {
+        build_linear_subtree(prims, start, split.mid, options, nodes, depth + 1);
+        nodes[index].offset = build_linear_subtree(prims, split.mid, end, options, nodes, depth + 1);
+        return index;
+    }
+
+    std::vector<linear_bvh_node> left_nodes, right_nodes;
+    #pragma omp task default(shared)
+    build_linear_subtree(prims, start, split.mid, options, left_nodes, depth + 1);
+    build_linear_subtree(prims, split.mid, end, options, right_nodes, depth + 1);
+    #pragma omp taskwait
+
+    for (auto* subtree : { &left_nodes, &right_nodes }) {
+        const uint32_t base = static_cast<uint32_t>(nodes.size());
+        for (linear_bvh_node node : *subtree) {
+            if (node.prim_count == 0)
+                node.offset += base;
+            nodes.push_back(node);
+        }
+    }
+    nodes[index].offset = index + 1 + static_cast<uint32_t>(left_nodes.size());
+    return index;
+}
+
+// Builds flattened nodes directly from build primitives, reordering prims so
+// that every leaf's primitives are contiguous. Subtrees that would overflow
+// the traversal stack are collapsed into a single leaf, or halved by object
+// median until they fit in one.
+inline uint32_t build_linear_bvh(std::vector<bvh_primitive>& prims, size_t start, size_t end,
+                                 const bvh_build_options& options, std::vector<linear_bvh_node>& nodes) {
+    uint32_t root = 0;
+    #pragma omp parallel if(end - start >= bvh_parallel_threshold)
+    #pragma omp single
+    root = build_linear_subtree(prims, start, end, options, nodes, 0);
+    return root;
+}
+
+class linear_bvh : public hittable {
+public:
+    linear_bvh() {}
+
+    linear_bvh(const hittable_list& list, const bvh_build_options& options = bvh_build_options()) {
+        std::vector<bvh_primitive> prims = make_bvh_primitives(list.objects, "linear_bvh");
+
+        if (prims.empty())
+            return;
+
+        build_linear_bvh(prims, 0, prims.size(), options, nodes);
+        box = primitive_bounds(prims, 0, prims.size());
+
+        for (const auto& p : prims)
+            add_primitive(list.objects[p.index]);
+    }
+
+    linear_bvh(const bvh_node& root) {
+        if (root.is_leaf() && root.objects.empty())
+            return;
+        flatten(root, 0);
+        box = root.box;
+    }
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        if (nodes.empty())
+            return false;
+
+        return traverse_linear_bvh(nodes.data(), r, t_min, t_max,
+            [&](uint32_t first, uint32_t count, double& closest) {
+                bool hit_anything = false;
+                for (uint32_t i = first; i < first + count; ++i) {
+                    if (primitives[i]->hit(r, t_min, closest, rec)) {
+                        hit_anything = true;
+                        closest = rec.t;
+                    }
+                }
+                return hit_anything;
+            });
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        if (nodes.empty())
+            return false;
+
+        return traverse_linear_bvh<true>(nodes.data(), r, t_min, t_max,
+            [&](uint32_t first, uint32_t count, double& closest) {
+                for (uint32_t i = first; i < first + count; ++i) {
+                    if (primitives[i]->occluded(r, t_min, closest))
+                        return true;
+                }
+                return false;
+            });
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        double result = 1.0;
+        for (const hittable* medium : media)
+            result *= medium->transmittance(r, t_min, t_max);
+        return result;
+    }
+
+    virtual bool has_media() const override { return !media.empty(); }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        if (nodes.empty()) return false;
+        output_box = box;
+        return true;
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+public:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<const hittable*> primitives;
+    aabb box;
+
+private:
+    std::vector<std::shared_ptr<hittable>> owned;
+    std::vector<const hittable*> media;   // few, so shadow rays test each directly
+
+    void add_primitive(const std::shared_ptr<hittable>& object) {
+        owned.push_back(object);
+        primitives.push_back(object.get());
+        if (object->has_media())
+            media.push_back(object.get());
+    }
+
+    void collect(const bvh_node& node) {
+        if (node.is_leaf()) {
+            for (const auto& object : node.objects)
+                add_primitive(object);
+            return;
+        }
+        collect(*node.left);
+        collect(*node.right);
+    }
+
+    uint32_t flatten(const bvh_node& node, int depth) {
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        set_node_bounds(nodes[index], node.box);
+
+        // At the depth limit the rest of the subtree becomes one leaf, unless
+        // it holds too many primitives for that; then the tree goes on into
+        // the stack's spare levels.
+        if (node.is_leaf() || (depth >= linear_bvh_max_depth - 1
+                               && node.primitive_count() <= linear_bvh_max_leaf_size)) {
+            size_t first = primitives.size();
+            collect(node);
+            nodes[index].offset = static_cast<uint32_t>(first);
+            nodes[index].prim_count = static_cast<uint16_t>(primitives.size() - first);
+            nodes[index].axis = 0;
+            return index;
+        }
+
+        if (depth >= linear_bvh_stack_size - 1) {
+            std::cerr << "linear_bvh: a subtree of " << node.primitive_count()
+                      << " primitives is too deep to flatten\n";
+            std::abort();
+        }
+        nodes[index].prim_count = 0;
+        nodes[index].axis = static_cast<uint8_t>(node.axis);
+        flatten(*node.left, depth + 1);
+        uint32_t second = flatten(*node.right, depth + 1);
+        nodes[index].offset = second;
+        return index;
+    }
+};
+
+#endif
@@ -2,6 +2,11 @@
 #include <cmath>
 #include <vector>
 #include <fstream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <mutex>
 #ifdef _OPENMP
 #include <omp.h> 
 #endif
@@ -9,237 +14,295 @@
 #include "color.h"
 #include "ray.h"
 #include "rtweekend.h"
-#include "hittable_list.h"
-#include "sphere.h"
 #include "camera.h"
-#include "material.h"
-#include "lambertian.h"
-#include "metal.h"
-#include "dielectric.h"
-#include "triangle.h"
-#include "solid_color.h"
-#include "checker_texture.h"
-#include "image_texture.h"
-#include "obj_loader.h"
-#include "emissive.h"
-#include "bvh.h"
-#include "moving_sphere.h"
-#include "perlin.h"
-#include "noise_texture.h"
-#include "quad.h"
-#include "translate.h"
-#include "translate.h"
-#include "constant_medium.h"
-
-color ray_color(const ray& r, const hittable& world, const point3& light_pos, double light_radius, int depth) {
-    hit_record rec;
-
-    if (depth <= 0)
-        return color(0, 0, 0);
-
-    if (!world.hit(r, 0.001, infinity, rec)) {
-        vec3 unit_dir = unit_vector(r.direction());
-        double t = 0.5 * (unit_dir.y() + 1.0);
-        return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
-    }
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat_ptr->emitted();
-    
-    bool did_scatter = rec.mat_ptr->scatter(r, rec, attenuation, scattered);
-    
-    if (!did_scatter) {
-        return emitted;
-    }
-    
-    color direct_light(0, 0, 0);
-    bool is_volume = (rec.normal.x() == 1.0 && rec.normal.y() == 0.0 && rec.normal.z() == 0.0);
-    
-    if (!is_volume) {
-        vec3 random_in_light_sphere = light_radius * random_unit_vector();
-        vec3 light_sample_pos = light_pos + random_in_light_sphere;
-        vec3 to_light_sample = light_sample_pos - rec.p;
-        double dist_to_sample = to_light_sample.length();
-        vec3 shadow_dir = unit_vector(to_light_sample);
-        ray shadow_ray(rec.p + rec.normal * 0.001, shadow_dir);
-        hit_record shadow_rec;
-        
-        bool hit_before_light = world.hit(shadow_ray, 0.001, dist_to_sample - 0.001, shadow_rec);
-        
-        if (!hit_before_light) {
-            double cos_theta = std::max(0.0, dot(rec.normal, shadow_dir));
-            if (cos_theta > 0) {
-                vec3 to_light = light_pos - rec.p;
-                double distance_to_light_sq = to_light.length_squared();
-                double light_area = 4.0 * pi * light_radius * light_radius;
-                double solid_angle = light_area / distance_to_light_sq;
-                direct_light = attenuation * color(8, 8, 8) * cos_theta * solid_angle;
+#include "tile_scheduler.h"
+#include "image_writer.h"
+#include "integrator.h"
+#include "sampler.h"
+#include "denoiser.h"
+#include "accumulation_buffer.h"
+#include "scene.h"
+#include "texture_cache.h"
+
+// Renders each scene file on the command line (../scenes/default.scene if
+// none) to the outputs the scene names; see scene.h for the format. With a
+// single scene, other arguments replace its outputs, and the extension picks
+// the format (.ppm, .pfm or .hdr). With denoising on, the denoised frame goes
+// to those paths and the noisy frame and the denoiser's guides (albedo,
+// normal, depth) are written as PFMs next to the first one.
+//
+// Rendering runs in progressive passes, checkpointing the accumulated samples
+// every few minutes. Options:
+//   --checkpoint PATH     checkpoint file (the first output with .ckpt for
+//                         its extension; single scene only)
+//   --resume              continue from the checkpoint
+//   --time-limit SECONDS  stop after the pass that runs past this, checkpoint
+//                         and write the image as it stands
+//   --noise-target E      standard error at which a pixel stops sampling,
+//                         overriding the scenes' noise_target
+//   --texture-memory MB   budget of the image texture tile cache (256)
+struct render_options {
+    std::string checkpoint_path;
+    bool resume = false;
+    double time_limit = 0;
+    double noise_target = -1;   // < 0: the scene's
+};
+
+static bool render_scene(const scene& sc, const render_options& options) {
+    const render_settings& settings = sc.settings;
+    const int image_width = settings.image_width;
+    const int image_height = settings.image_height;
+    const int samples_per_pixel = settings.samples_per_pixel;
+    const int max_depth = settings.max_depth;
+    const int rr_min_depth = settings.rr_min_depth;
+    const int tile_size = settings.tile_size;
+    const uint64_t render_seed = settings.seed;
+    const sampler_type pixel_sampler = settings.pixel_sampler;
+    const bool denoise_output = settings.denoise;
+    const int pass_samples = settings.pass_samples;
+    const double noise_target = options.noise_target >= 0 ? options.noise_target : settings.noise_target;
+    const double checkpoint_interval = 300;   // seconds
+    const std::vector<std::string>& output_paths = sc.outputs;
+    const std::string& first_output = output_paths.front();
+    const std::string checkpoint_path = options.checkpoint_path.empty()
+        ? first_output.substr(0, first_output.find_last_of('.')) + ".ckpt" : options.checkpoint_path;
+    const double time_limit = options.time_limit;
+
+    const tlas& accel = sc.accel;
+    const light_list& lights = sc.lights;
+    std::cerr << "Lights: " << lights.size() << "\n";
+    std::cerr << "BVH SAH cost: " << accel.sah_cost() << "\n";
+    std::cerr << "Wide BVH: " << accel.accelerator().width() << "-wide, " << accel.accelerator().node_count()
+              << " nodes, " << accel.accelerator().kernel_name() << " slab test\n";
+    const camera cam = sc.make_camera();
+
+    const int min_samples = 30;
+    accumulation_buffer accum(image_width, image_height);
+
+    auto below_noise_target = [&](const pixel_sums& px) {
+        double n = px.count;
+        color mean = px.sum / n;
+        double var_r = (px.sum_sq.x() / n) - mean.x() * mean.x();
+        double var_g = (px.sum_sq.y() / n) - mean.y() * mean.y();
+        double var_b = (px.sum_sq.z() / n) - mean.z() * mean.z();
+        double max_std = std::sqrt(std::max({var_r, var_g, var_b}));
+        return max_std / std::sqrt(n) < noise_target;
+    };
+
+    // Everything that changes what a sample computes; a checkpoint only
+    // resumes under the same scene and settings. That includes the sample
+    // count, which sets the stratified sampler's strata and the texture
+    // footprint of camera rays.
+    uint64_t settings_key = hash_seed(render_seed, static_cast<uint64_t>(pixel_sampler));
+    settings_key = hash_seed(settings_key, sc.content_hash);
+    for (int setting : { image_width, image_height, samples_per_pixel, max_depth, rr_min_depth, min_samples })
+        settings_key = hash_seed(settings_key, static_cast<uint64_t>(setting));
+    if (options.resume) {
+        if (!accum.load(checkpoint_path, settings_key))
+            return false;
+        std::cerr << "Resumed from " << checkpoint_path << " (" << accum.total_samples() << " samples)\n";
+        // The noise target may differ from the one the checkpoint was
+        // rendered with. A pixel stopped when it passed the test, so under
+        // the same target it passes again here and stays stopped.
+        for (int j = 0; j < image_height; ++j) {
+            for (int i = 0; i < image_width; ++i) {
+                pixel_sums& px = accum.at(i, j);
+                if (px.converged && !below_noise_target(px))
+                    px.converged = false;
             }
         }
     }
-    
-    color indirect_light = attenuation * ray_color(scattered, world, light_pos, light_radius, depth - 1);
-    
-    return emitted + direct_light + indirect_light;
-}
 
-void write_rgbe(std::ofstream& out, float r, float g, float b) {
-    float v = std::max({r, g, b});
-    if (v < 1e-32f) {
-        out.put(0); out.put(0); out.put(0); out.put(0);
-        return;
-    }
-    int e;
-    float m = std::frexp(v, &e) * 256.0f / v;
-    out.put(static_cast<unsigned char>(r * m));
-    out.put(static_cast<unsigned char>(g * m));
-    out.put(static_cast<unsigned char>(b * m));
-    out.put(static_cast<unsigned char>(e + 128));
-}
+#ifdef _OPENMP
+    const int thread_count = omp_get_max_threads();
+#else
+    const int thread_count = 1;
+#endif
+    tile_scheduler scheduler(image_width, image_height, tile_size, tile_order::hilbert, thread_count);
+    std::vector<path_stats> thread_path_stats(thread_count);
+    auto prototype_sampler = make_sampler(pixel_sampler, samples_per_pixel, render_seed);
+    std::vector<std::unique_ptr<sampler>> thread_samplers;
+    for (int t = 0; t < thread_count; ++t)
+        thread_samplers.push_back(prototype_sampler->clone());
+    std::cerr << "Sampler: " << prototype_sampler->name() << "\n";
+    std::mutex progress_lock;
 
-int main() {
-    const double aspect_ratio = 16.0 / 9.0;
-    // const int image_width = 400;
-    const int image_width = 1200;
-    const int image_height = static_cast<int>(image_width / aspect_ratio);
-    // const int samples_per_pixel = 100;
-    const int samples_per_pixel = 500;
-    const int max_depth = 50;
-
-    auto wood_tex = std::make_shared<image_texture>("../src/wood.jpg");
-    auto checker_tex = std::make_shared<checker_texture>(
-        color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9)
-    );
-
-    auto ground_mat = std::make_shared<lambertian>(checker_tex);
-    auto center_mat = std::make_shared<lambertian>(color(0.1, 0.2, 0.5));
-    auto glass_mat = std::make_shared<dielectric>(1.5);
-    auto metal_mat = std::make_shared<metal>(color(0.8, 0.6, 0.2), 0.0);
-    auto tri_mat = std::make_shared<lambertian>(wood_tex);
-
-    hittable_list world;
-    world.add(std::make_shared<sphere>(point3(0, -100.5, -1), 100, ground_mat));
-    world.add(std::make_shared<sphere>(point3(0, 0, -1), 0.5, center_mat));
-    world.add(std::make_shared<sphere>(point3(-1, 0, -1), 0.5, glass_mat));
-    world.add(std::make_shared<sphere>(point3(-1, 0, -1), -0.45, glass_mat));
-    world.add(std::make_shared<sphere>(point3(1, 0, -1), 0.5, metal_mat));
-
-    const std::string obj_path = "../src/models/cube.obj";
-    int loaded_triangles = load_obj_as_triangles(obj_path, world, tri_mat);
-    std::cerr << "Loaded triangles from OBJ: " << loaded_triangles << " (path: " << obj_path << ")\n";
-    if (loaded_triangles == 0) {
-        world.add(std::make_shared<triangle>(
-            point3(-0.75,0.25,-0.5),
-            point3(0.75,0.25,-0.5),
-            point3(0.0,1.0,-1.0),
-            vec2(0,0), vec2(1,0), vec2(0.5,1),
-            tri_mat
-        ));
-    }    
-
-    auto light_mat = std::make_shared<emissive>(color(8, 8, 8));
-    world.add(std::make_shared<sphere>(point3(0, 3, -1), 0.5, light_mat));
-    point3 light_position(0, 3, -1);
-    double light_radius = 0.5;
-
-    auto moving_mat = std::make_shared<lambertian>(color(0.7, 0.3, 0.3));
-    world.add(std::make_shared<moving_sphere>(
-        point3(-0.5, 0.5, -1.0),
-        point3( 0.5, 0.5, -1.0),
-        0.0, 1.0,
-        0.25,
-        moving_mat
-    ));
-
-    auto noise_tex = std::make_shared<noise_texture>(4.0);
-    auto noise_mat = std::make_shared<lambertian>(noise_tex);
-    world.add(std::make_shared<sphere>(point3(1.5, 0.5, -1), 0.5, noise_mat));
-
-    auto wall_mat = std::make_shared<lambertian>(color(0.8, 0.2, 0.2));
-    world.add(std::make_shared<quad>(
-        point3(-2, -1, -3),
-        point3(2, 2, -3),
-        wall_mat,
-        2
-    ));
-
-    auto instanced_mat = std::make_shared<lambertian>(color(0.2, 0.8, 0.2));
-    auto instanced_sphere = std::make_shared<sphere>(point3(0, 0.5, -2), 0.3, instanced_mat);
-
-    world.add(instanced_sphere);
-
-    world.add(std::make_shared<translate>(instanced_sphere, vec3(1, 0, 0)));
-    world.add(std::make_shared<translate>(instanced_sphere, vec3(-1, 0, 0)));
-    world.add(std::make_shared<translate>(instanced_sphere, vec3(0, 1, 0)));
-
-    auto fog_boundary = std::make_shared<sphere>(point3(-1.5, 0.5, -1.5), 0.8, nullptr);
-    auto fog = std::make_shared<constant_medium>(fog_boundary, 0.15, color(0.88, 0.88, 0.95));
-    world.add(fog);
-
-    bvh_node bvh_tree(world);
-
-    point3 lookfrom(3, 3, 2);
-    point3 lookat(0, 0, -1);
-    vec3 vup(0, 1, 0);
-    double vfov = 40.0;
-    double dist_to_focus = (lookfrom - lookat).length();
-    double aperture = 0.05;
-    camera cam(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus);      
-
-    std::vector<std::vector<color>> framebuffer(image_height, std::vector<color>(image_width));
-    std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
-
-    std::vector<std::vector<int>> sample_counts(image_height, std::vector<int>(image_width, 0));
-    const int min_samples = 30;
-    const double variance_threshold = 0.001;
+    // Each pass adds up to pass_samples samples to every pixel that is still
+    // sampling. A pixel's samples keep their indices whatever the passes, so
+    // the image does not depend on the pass size or on resuming.
+    using clock = std::chrono::steady_clock;
+    const auto render_start = clock::now();
+    auto last_checkpoint = render_start;
+    for (int pass = 1;; ++pass) {
+        std::atomic<size_t> tiles_done(0);
+        std::atomic<size_t> active_pixels(0);
 
-    #pragma omp parallel for schedule(dynamic)
-    for (int j = image_height - 1; j >= 0; --j) {
-    #pragma omp critical
-        std::cerr << "\rScanlines remaining: " << j << " " << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0, 0, 0);
-            double sum_r_sq = 0, sum_g_sq = 0, sum_b_sq = 0;
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                double u = (i + random_double()) / (image_width - 1);
-                double v = (j + random_double()) / (image_height - 1);
-                ray r = cam.get_ray(u, v);
-                color sample = ray_color(r, bvh_tree, light_position, light_radius, max_depth);
-                pixel_color += sample;
-                sum_r_sq += sample.x() * sample.x();
-                sum_g_sq += sample.y() * sample.y();
-                sum_b_sq += sample.z() * sample.z();
-                sample_counts[j][i]++;
-                if (s >= 30 && s % 10 == 0) {
-                    double n = s + 1;
-                    color mean = pixel_color / n;
-                    double var_r = (sum_r_sq / n) - mean.x() * mean.x();
-                    double var_g = (sum_g_sq / n) - mean.y() * mean.y();
-                    double var_b = (sum_b_sq / n) - mean.z() * mean.z();
-                    double max_std = std::sqrt(std::max({var_r, var_g, var_b}));
-                    if (max_std / std::sqrt(n) < 0.001) {
-                        break;
+        scheduler.run([&](const tile& t, int thread_id) {
+            pcg32& rng = thread_rng();
+            sampler& samp = *thread_samplers[thread_id];
+            path_stats& stats = thread_path_stats[thread_id];
+            for (int j = t.y0; j < t.y1; ++j) {
+                for (int i = t.x0; i < t.x1; ++i) {
+                    pixel_sums& px = accum.at(i, j);
+                    const int pass_end = std::min(samples_per_pixel, px.count + pass_samples);
+                    const uint64_t pixel_seed = hash_seed(render_seed, static_cast<uint64_t>(j) * image_width + i);
+                    while (!px.converged && px.count < pass_end) {
+                        const int s = px.count;
+                        // Media still draw from the thread's generator; reseeding it
+                        // keeps them deterministic as well.
+                        rng.seed(pixel_seed, s);
+                        samp.start_pixel_sample(i, j, s);
+                        vec2 jitter = samp.get_2d();
+                        double u = (i + jitter.x()) / (image_width - 1);
+                        double v = (j + jitter.y()) / (image_height - 1);
+                        ray r = cam.get_ray(u, v, samp);
+                        first_hit guide;
+                        color sample = ray_color(r, accel, lights, max_depth, rr_min_depth, samp, stats, &guide);
+                        px.sum += sample;
+                        px.sum_sq += sample * sample;
+                        double lum = 0.2126 * sample.x() + 0.7152 * sample.y() + 0.0722 * sample.z();
+                        px.luminance_sum += lum;
+                        px.luminance_sum_sq += lum * lum;
+                        px.albedo_sum += guide.albedo;
+                        px.normal_sum += guide.normal;
+                        px.depth_sum += guide.depth;
+                        px.count++;
+                        if (s >= min_samples && s % 10 == 0 && below_noise_target(px))
+                            px.converged = true;
                     }
+                    if (!px.converged && px.count < samples_per_pixel)
+                        active_pixels++;
                 }
             }
-            framebuffer[j][i] = pixel_color;
+
+            size_t done = ++tiles_done;
+            if (done % 16 == 0 || done == scheduler.tile_count()) {
+                std::lock_guard<std::mutex> guard(progress_lock);
+                std::cerr << "\rPass " << pass << ": tiles remaining: " << scheduler.tile_count() - done << " " << std::flush;
+            }
+        });
+
+        const auto now = clock::now();
+        const double elapsed = std::chrono::duration<double>(now - render_start).count();
+        const bool finished = active_pixels == 0;
+        const bool out_of_time = time_limit > 0 && elapsed >= time_limit;
+        std::cerr << "\rPass " << pass << ": " << active_pixels << " pixels still sampling after "
+                  << elapsed << "s\n";
+
+        if (finished || out_of_time || std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval) {
+            if (accum.save(checkpoint_path, settings_key))
+                std::cerr << "Checkpoint written to " << checkpoint_path << "\n";
+            last_checkpoint = clock::now();
+        }
+        if (finished)
+            break;
+        if (out_of_time) {
+            std::cerr << "Time limit reached; continue with --resume\n";
+            break;
         }
-    }    
+    }
+
+    scheduler.report(std::cerr);
+    const texture_cache_stats texture_stats = texture_cache::global().statistics();
+    if (texture_stats.hits + texture_stats.misses > 0)
+        texture_cache::global().report(std::cerr);
 
-    for (int j = image_height - 1; j >= 0; --j) {
+    path_stats totals;
+    for (const auto& stats : thread_path_stats) {
+        totals.paths += stats.paths;
+        totals.bounces += stats.bounces;
+        totals.roulette_terminated += stats.roulette_terminated;
+    }
+
+    // The accumulation buffer is stored bottom row first; images are written
+    // top down. Guides are averaged over the pixel; the variance is that of
+    // the pixel's mean luminance.
+    image_buffer image(image_width, image_height);
+    aov_buffers aovs(image_width, image_height);
+    std::vector<double> variance(static_cast<size_t>(image_width) * image_height);
+    for (int j = 0; j < image_height; ++j) {
         for (int i = 0; i < image_width; ++i) {
-            write_color(std::cout, framebuffer[j][i], sample_counts[j][i]);
+            const pixel_sums& px = accum.at(i, j);
+            const int row = image_height - 1 - j;
+            const size_t p = static_cast<size_t>(row) * image_width + i;
+            const double n = std::max(1, px.count);
+            image.at(i, row) = px.sum / n;
+            aovs.albedo.at(i, row) = px.count > 0 ? px.albedo_sum / n : color(1, 1, 1);
+            aovs.normal.at(i, row) = px.normal_sum.length_squared() > 0 ? unit_vector(px.normal_sum) : vec3(0, 0, 0);
+            aovs.depth[p] = px.depth_sum / n;
+            const double mean_lum = px.luminance_sum / n;
+            variance[p] = n > 1 ? std::max(0.0, px.luminance_sum_sq - n * mean_lum * mean_lum) / ((n - 1) * n) : 0.0;
         }
     }
-    std::ofstream hdrfile("output.hdr", std::ios::binary);
-    hdrfile << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << image_height << " +X " << image_width << "\n";
 
-    for (int j = image_height - 1; j >= 0; --j) {
-        for (int i = 0; i < image_width; ++i) {
-            color c = framebuffer[j][i] / static_cast<float>(sample_counts[j][i]);
-            write_rgbe(hdrfile, c.x(), c.y(), c.z());
+    if (denoise_output) {
+        const std::string& first = output_paths.front();
+        const std::string stem = first.substr(0, first.find_last_of('.'));
+        image_buffer depth(image_width, image_height);
+        for (size_t p = 0; p < depth.pixels.size(); ++p)
+            depth.pixels[p] = color(aovs.depth[p], aovs.depth[p], aovs.depth[p]);
+        write_image(stem + ".noisy.pfm", image);
+        write_image(stem + ".albedo.pfm", aovs.albedo);
+        write_image(stem + ".normal.pfm", aovs.normal);
+        write_image(stem + ".depth.pfm", depth);
+        image = denoise(image, variance, aovs);
+        std::cerr << "Denoised\n";
+    }
+
+    for (const auto& path : output_paths) {
+        if (write_image(path, image))
+            std::cerr << "Wrote " << path << "\n";
+    }
+    std::cerr << "Average path length: " << static_cast<double>(totals.bounces) / std::max<uint64_t>(1, totals.paths)
+              << " bounces over " << totals.paths << " paths, "
+              << 100.0 * totals.roulette_terminated / std::max<uint64_t>(1, totals.paths) << "% ended by Russian roulette\n";
+    std::cerr << "Done.\n";
+    return true;
+}
+
+int main(int argc, char** argv) {
+    render_options options;
+    std::vector<std::string> scene_paths;
+    std::vector<std::string> output_paths;
+    for (int a = 1; a < argc; ++a) {
+        const std::string arg = argv[a];
+        if (arg == "--resume") {
+            options.resume = true;
+        } else if ((arg == "--checkpoint" || arg == "--time-limit" || arg == "--noise-target"
+                    || arg == "--texture-memory") && a + 1 < argc) {
+            const std::string value = argv[++a];
+            if (arg == "--checkpoint") options.checkpoint_path = value;
+            else if (arg == "--time-limit") options.time_limit = std::atof(value.c_str());
+            else if (arg == "--texture-memory") texture_cache::global().set_budget(static_cast<size_t>(std::atof(value.c_str()) * (1 << 20)));
+            else options.noise_target = std::atof(value.c_str());
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown or incomplete option " << arg << "\n";
+            return 1;
+        } else if (arg.size() > 6 && arg.compare(arg.size() - 6, 6, ".scene") == 0) {
+            scene_paths.push_back(arg);
+        } else {
+            output_paths.push_back(arg);
         }
     }
-    hdrfile.close();
-    std::cerr << "\nDone.\n";
-}
\ No newline at end of file
+    if (scene_paths.empty())
+        scene_paths.push_back("../scenes/default.scene");
+    if (scene_paths.size() > 1 && (!output_paths.empty() || !options.checkpoint_path.empty())) {
+        std::cerr << "Output paths and --checkpoint need a single scene; name outputs in the scene files\n";
+        return 1;
+    }
+
+    int failures = 0;
+    for (const auto& path : scene_paths) {
+        std::cerr << "Scene " << path << "\n";
+        scene sc;
+        if (!load_scene(path, sc)) {
+            ++failures;
+            continue;
+        }
+        if (!output_paths.empty())
+            sc.outputs = output_paths;
+        if (!render_scene(sc, options))
+            ++failures;
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A whole file mapped read-only into memory (POSIX mmap), unmapped when the
+// last reference goes away. Pages are read in on first touch, so opening
+// even a large file is close to free.
+class mapped_file {
+public:
+    // nullptr if the file cannot be opened or mapped, or is empty.
+    static std::shared_ptr<const mapped_file> open(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        struct stat info;
+        void* address = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+            address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED)
+            return nullptr;
+        return std::shared_ptr<const mapped_file>(new mapped_file(static_cast<const char*>(address),
+                                                                  static_cast<size_t>(info.st_size)));
+    }
+
+    ~mapped_file() { munmap(const_cast<char*>(bytes), length); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    mapped_file(const char* bytes, size_t length) : bytes(bytes), length(length) {}
+
+    const char* bytes;
+    size_t length;
+};
@@ -2,6 +2,10 @@
 #include "ray.h"
 #include "hittable.h"
 #include "color.h"
+#include "sampler.h"
+#include <cmath>
+#include <memory>
+#include <vector>
 
 class material {
 public:
@@ -9,10 +13,102 @@ public:
         const ray& r_in,
         const hit_record& rec,
         color& attenuation,
-        ray& scattered
+        ray& scattered,
+        sampler& samp
     ) const = 0;
 
-    virtual color emitted() const {
+    // Radiance leaving the surface toward the ray that produced rec.
+    virtual color emitted(const hit_record& rec) const {
         return color(0, 0, 0);
     }
+
+    // Materials that can be evaluated for an arbitrary direction wi take part
+    // in light sampling. eval() is the BSDF times the cosine term (so that
+    // eval / scattering_pdf matches scatter()'s attenuation) and
+    // scattering_pdf() is the solid-angle density of scatter() choosing wi.
+    // Specular materials (the default) are only reached by scattering.
+    virtual bool is_specular() const { return true; }
+
+    virtual color eval(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        return color(0, 0, 0);
+    }
+
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const {
+        return 0.0;
+    }
+
+    // Surface color at rec for the denoiser's albedo buffer.
+    virtual color reflectance(const hit_record& rec) const {
+        return color(1, 1, 1);
+    }
+};
+
+// Differentials for a ray scattered from rec by perfect reflection, or by
+// refraction with relative index eta, following how the offset rays would
+// bend at the offset hits (Igehy, "Tracing Ray Differentials"). Nothing is
+// set when r_in carries none.
+inline void set_specular_differentials(const ray& r_in, const hit_record& rec, bool refracted, double eta,
+                                       ray& scattered) {
+    if (!r_in.has_differentials())
+        return;
+    const ray_differentials& d = r_in.differentials();
+    const vec3& n = rec.normal;
+    const vec3 wo = -unit_vector(r_in.direction());
+    const vec3 wi = unit_vector(scattered.direction());
+    const vec3 dndx = rec.dndx(), dndy = rec.dndy();
+    const vec3 dwodx = -unit_vector(d.rx_direction) - wo;
+    const vec3 dwody = -unit_vector(d.ry_direction) - wo;
+    const double cos_o = dot(wo, n);
+    const double dcosdx = dot(dwodx, n) + dot(wo, dndx);
+    const double dcosdy = dot(dwody, n) + dot(wo, dndy);
+
+    ray_differentials out;
+    out.rx_origin = rec.p + rec.dpdx;
+    out.ry_origin = rec.p + rec.dpdy;
+    if (!refracted) {
+        out.rx_direction = wi - dwodx + 2 * (cos_o * dndx + dcosdx * n);
+        out.ry_direction = wi - dwody + 2 * (cos_o * dndy + dcosdy * n);
+    } else {
+        const double cos_i = std::fmax(std::fabs(dot(wi, n)), 1e-6);
+        const double mu = eta * cos_o - cos_i;
+        const double dmu = eta - eta * eta * cos_o / cos_i;
+        out.rx_direction = wi - eta * dwodx + mu * dndx + dmu * dcosdx * n;
+        out.ry_direction = wi - eta * dwody + mu * dndy + dmu * dcosdy * n;
+    }
+    scattered.set_differentials(out);
+}
+
+// Diffuse scattering has no useful differentials. The scattered ray starts
+// from the footprint at rec and widens it over a fixed cone, which keeps
+// texture lookups after a diffuse bounce on coarse mip levels.
+inline void set_diffuse_differentials(const ray& r_in, const hit_record& rec, ray& scattered) {
+    if (!r_in.has_differentials())
+        return;
+    const double spread = 0.1;   // radians
+    const vec3 wi = unit_vector(scattered.direction());
+    vec3 a, b;
+    onb_from_w(wi, a, b);
+
+    ray_differentials out;
+    out.rx_origin = rec.p + rec.dpdx;
+    out.ry_origin = rec.p + rec.dpdy;
+    out.rx_direction = wi + spread * a;
+    out.ry_direction = wi + spread * b;
+    scattered.set_differentials(out);
+}
+
+// Owns every material of a scene. Primitives and hit records hold plain
+// pointers into the table, so recording a hit never touches a reference
+// count shared between threads. The table must outlive the scene.
+class material_table {
+public:
+    const material* add(std::shared_ptr<material> m) {
+        materials.push_back(std::move(m));
+        return materials.back().get();
+    }
+
+    size_t size() const { return materials.size(); }
+
+private:
+    std::vector<std::shared_ptr<material>> materials;
 };
\ No newline at end of file
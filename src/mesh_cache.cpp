@@ -0,0 +1,190 @@
+#include "mesh_cache.h"
+#include "binary_io.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char magic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', '0', '1' };
+// Bump whenever the layout, the OBJ welding or the BVH builder changes.
+const uint32_t format_version = 1;
+
+const uint32_t has_normals_flag = 1;
+const uint32_t has_uvs_flag = 2;
+
+const size_t header_bytes = preamble_bytes + sizeof(uint32_t) + 4 * sizeof(uint64_t)
+                          + 2 * sizeof(uint32_t) + 6 * sizeof(double);
+const size_t array_alignment = 64;
+
+// Byte offsets of every array in the file; 0 for arrays that are absent.
+struct cache_layout {
+    size_t position[3] = {};
+    size_t normal[3] = {};
+    size_t uv[2] = {};
+    size_t indices = 0;
+    size_t nodes = 0;
+    size_t total = 0;
+};
+
+cache_layout layout_for(size_t vertex_count, size_t triangle_count, size_t node_count, uint32_t flags) {
+    cache_layout layout;
+    size_t end = header_bytes;
+    auto place = [&](size_t bytes) {
+        const size_t offset = (end + array_alignment - 1) / array_alignment * array_alignment;
+        end = offset + bytes;
+        return offset;
+    };
+    const size_t attribute_bytes = vertex_count * sizeof(float);
+    for (auto& offset : layout.position)
+        offset = place(attribute_bytes);
+    if (flags & has_normals_flag)
+        for (auto& offset : layout.normal)
+            offset = place(attribute_bytes);
+    if (flags & has_uvs_flag)
+        for (auto& offset : layout.uv)
+            offset = place(attribute_bytes);
+    layout.indices = place(triangle_count * 3 * sizeof(uint32_t));
+    layout.nodes = place(node_count * sizeof(linear_bvh_node));
+    layout.total = end;
+    return layout;
+}
+
+uint64_t bits_of(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+} // namespace
+
+uint64_t mesh_cache_key(const std::string& source_path, const bvh_build_options& options) {
+    uint64_t key = file_stat_key(source_path, format_version);
+    if (key == 0)
+        return 0;
+    key = hash_seed(key, static_cast<uint64_t>(options.method));
+    key = hash_seed(key, static_cast<uint64_t>(options.bin_count));
+    key = hash_seed(key, static_cast<uint64_t>(options.max_leaf_size));
+    key = hash_seed(key, bits_of(options.traversal_cost));
+    return hash_seed(key, bits_of(options.intersection_cost));
+}
+
+bool save_mesh_cache(const std::string& path, uint64_t key, const triangle_mesh& mesh) {
+    const mesh_arrays& a = mesh.arrays();
+    const uint32_t flags = (a.nx ? has_normals_flag : 0) | (a.u ? has_uvs_flag : 0);
+    const cache_layout layout = layout_for(a.vertex_count, a.triangle_count, a.node_count, flags);
+    aabb box;
+    mesh.bounding_box(box);
+
+    std::string header;
+    put_preamble(header, magic);
+    put(header, format_version);
+    put(header, key);
+    put(header, static_cast<uint64_t>(a.vertex_count));
+    put(header, static_cast<uint64_t>(a.triangle_count));
+    put(header, static_cast<uint64_t>(a.node_count));
+    put(header, flags);
+    put(header, uint32_t(0));
+    for (int i = 0; i < 3; ++i)
+        put(header, box.min()[i]);
+    for (int i = 0; i < 3; ++i)
+        put(header, box.max()[i]);
+
+    const size_t attribute_bytes = a.vertex_count * sizeof(float);
+    const bool written = write_file_atomically(path, [&](std::ostream& out) {
+        size_t end = 0;
+        auto write_at = [&](size_t offset, const void* data, size_t bytes) {
+            static const char zeros[array_alignment] = {};
+            out.write(zeros, static_cast<std::streamsize>(offset - end));
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+            end = offset + bytes;
+        };
+        write_at(0, header.data(), header.size());
+        write_at(layout.position[0], a.px, attribute_bytes);
+        write_at(layout.position[1], a.py, attribute_bytes);
+        write_at(layout.position[2], a.pz, attribute_bytes);
+        if (flags & has_normals_flag) {
+            write_at(layout.normal[0], a.nx, attribute_bytes);
+            write_at(layout.normal[1], a.ny, attribute_bytes);
+            write_at(layout.normal[2], a.nz, attribute_bytes);
+        }
+        if (flags & has_uvs_flag) {
+            write_at(layout.uv[0], a.u, attribute_bytes);
+            write_at(layout.uv[1], a.v, attribute_bytes);
+        }
+        write_at(layout.indices, a.indices, a.triangle_count * 3 * sizeof(uint32_t));
+        write_at(layout.nodes, a.nodes, a.node_count * sizeof(linear_bvh_node));
+    });
+    if (!written) {
+        std::cerr << "Could not write mesh cache " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<triangle_mesh> load_mesh_cache(const std::string& path, uint64_t key, const material* m) {
+    auto file = mapped_file::open(path);
+    const char* cursor = file ? file->data() : nullptr;
+    bool same_byte_order = false;
+    if (!file || file->size() < header_bytes || !get_preamble(cursor, magic, same_byte_order) || !same_byte_order)
+        return nullptr;
+
+    uint32_t version, flags, pad;
+    uint64_t file_key, vertex_count, triangle_count, node_count;
+    double bounds[6];
+    get(cursor, version);
+    get(cursor, file_key);
+    get(cursor, vertex_count);
+    get(cursor, triangle_count);
+    get(cursor, node_count);
+    get(cursor, flags);
+    get(cursor, pad);
+    for (auto& b : bounds)
+        get(cursor, b);
+    if (version != format_version || file_key != key || node_count == 0)
+        return nullptr;
+
+    const cache_layout layout = layout_for(vertex_count, triangle_count, node_count, flags);
+    if (layout.total != file->size()) {
+        std::cerr << "Mesh cache " << path << " is truncated\n";
+        return nullptr;
+    }
+
+    const char* base = file->data();
+    auto floats = [&](size_t offset) { return offset ? reinterpret_cast<const float*>(base + offset) : nullptr; };
+    mesh_arrays a;
+    a.px = floats(layout.position[0]);
+    a.py = floats(layout.position[1]);
+    a.pz = floats(layout.position[2]);
+    a.nx = floats(layout.normal[0]);
+    a.ny = floats(layout.normal[1]);
+    a.nz = floats(layout.normal[2]);
+    a.u = floats(layout.uv[0]);
+    a.v = floats(layout.uv[1]);
+    a.indices = reinterpret_cast<const uint32_t*>(base + layout.indices);
+    a.nodes = reinterpret_cast<const linear_bvh_node*>(base + layout.nodes);
+    a.vertex_count = vertex_count;
+    a.triangle_count = triangle_count;
+    a.node_count = node_count;
+    const aabb box(point3(bounds[0], bounds[1], bounds[2]), point3(bounds[3], bounds[4], bounds[5]));
+    return std::make_shared<triangle_mesh>(a, box, file, m);
+}
+
+std::shared_ptr<triangle_mesh> load_obj_as_cached_mesh(const std::string& filename, const material* m,
+                                                       bool& from_cache) {
+    const std::string cache_path = filename + ".meshcache";
+    const uint64_t key = mesh_cache_key(filename, bvh_build_options());
+    from_cache = false;
+    if (key != 0) {
+        if (auto cached = load_mesh_cache(cache_path, key, m)) {
+            from_cache = true;
+            return cached;
+        }
+    }
+
+    auto mesh = load_obj_as_mesh(filename, m);
+    if (mesh && key != 0 && save_mesh_cache(cache_path, key, *mesh))
+        std::cerr << "Wrote mesh cache " << cache_path << "\n";
+    return mesh;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "bvh.h"
+#include "material.h"
+#include "triangle_mesh.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Binary cache of a built triangle_mesh: the welded vertex buffers, the index
+// buffer in BVH leaf order and the flattened BVH, each 64-byte aligned in
+// host byte order. A warm load maps the file and points the mesh straight at
+// it, skipping both the OBJ parse and the BVH build.
+//
+// Files carry a format version and a key; a cache whose key does not match
+// is ignored and rewritten.
+
+// Identifies the source file (by size and modification time) and the build
+// options. 0 if the source cannot be read.
+uint64_t mesh_cache_key(const std::string& source_path, const bvh_build_options& options);
+
+// Written to a temporary file and renamed into place; failures are reported
+// on std::cerr.
+bool save_mesh_cache(const std::string& path, uint64_t key, const triangle_mesh& mesh);
+
+// nullptr if there is no valid cache for key at path.
+std::shared_ptr<triangle_mesh> load_mesh_cache(const std::string& path, uint64_t key, const material* m);
+
+// load_obj_as_mesh through a cache at filename + ".meshcache", building and
+// writing the cache on a miss. from_cache reports which happened.
+std::shared_ptr<triangle_mesh> load_obj_as_cached_mesh(const std::string& filename, const material* m,
+                                                       bool& from_cache);
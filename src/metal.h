@@ -11,14 +11,21 @@ public:
         const ray& r_in,
         const hit_record& rec,
         color& attenuation,
-        ray& scattered
+        ray& scattered,
+        sampler& samp
     ) const override {
         vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere());
+        vec2 u = samp.get_2d();
+        scattered = ray(rec.p, reflected + fuzz * sample_unit_ball(u, samp.get_1d()));
+        set_specular_differentials(r_in, rec, false, 1.0, scattered);
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
+    virtual color reflectance(const hit_record& rec) const override {
+        return albedo;
+    }
+
 private:
     color albedo;
     double fuzz;
@@ -2,32 +2,37 @@
 #define MOVING_SPHERE_H
 
 #include "hittable.h"
+#include "sphere.h"
 
 class moving_sphere : public hittable {
 public:
     moving_sphere() {}
     moving_sphere(
-        point3 cen0, point3 cen1, double _time0, double _time1, double r, std::shared_ptr<material> m)
+        point3 cen0, point3 cen1, double _time0, double _time1, double r, const material* m)
         : center0(cen0), center1(cen1), time0(_time0), time1(_time1), radius(r), mat_ptr(m) {};
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override;
     virtual bool bounding_box(aabb& output_box) const override;
 
     point3 center(double time) const;
 
+private:
+    bool nearest_root(const ray& r, double t_min, double t_max, double& root) const;
+
 public:
     point3 center0, center1;
     double time0, time1;
     double radius;
-    std::shared_ptr<material> mat_ptr;
+    const material* mat_ptr;
 };
 
-point3 moving_sphere::center(double time) const {
+inline point3 moving_sphere::center(double time) const {
     // Linearly interpolate between center0 and center1 based on time
     return center0 + ((time - time0) / (time1 - time0))*(center1 - center0);
 }
 
-bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+inline bool moving_sphere::nearest_root(const ray& r, double t_min, double t_max, double& root) const {
     vec3 oc = r.origin() - center(r.time());  // Use center at ray's time
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -37,23 +42,37 @@ bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& re
     if (discriminant < 0) return false;
     auto sqrtd = sqrt(discriminant);
 
-    auto root = (-half_b - sqrtd) / a;
+    root = (-half_b - sqrtd) / a;
     if (root < t_min || t_max < root) {
         root = (-half_b + sqrtd) / a;
         if (root < t_min || t_max < root)
             return false;
     }
+    return true;
+}
+
+inline bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double root;
+    if (!nearest_root(r, t_min, t_max, root))
+        return false;
 
     rec.t = root;
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center(r.time())) / radius;
     rec.set_face_normal(r, outward_normal);
+    sphere::set_surface(outward_normal, radius, rec);
     rec.mat_ptr = mat_ptr;
+    rec.object = this;
 
     return true;
 }
 
-bool moving_sphere::bounding_box(aabb& output_box) const {
+inline bool moving_sphere::occluded(const ray& r, double t_min, double t_max) const {
+    double root;
+    return nearest_root(r, t_min, t_max, root);
+}
+
+inline bool moving_sphere::bounding_box(aabb& output_box) const {
     aabb box0(
         center0 - vec3(radius, radius, radius),
         center0 + vec3(radius, radius, radius));
@@ -3,19 +3,65 @@
 
 #include "texture.h"
 #include "perlin.h"
+#include "aabb.h"
+#include <cstddef>
+#include <vector>
 
+// What bake() built and how far its lookups stray from the procedural noise,
+// measured on random points inside the box.
+struct noise_bake_report {
+    int resolution = 0;
+    size_t bytes = 0;
+    double seconds = 0;
+    double rms_error = 0;
+    double max_error = 0;
+    double speedup = 0;   // procedural lookup time over baked lookup time
+};
+
+// Perlin turbulence at scale times the hit point. bake() optionally trades
+// memory for speed: inside a box, turbulence is then read back from a
+// precomputed grid with tricubic (Catmull-Rom) interpolation instead of
+// summing seven octaves of noise. Points outside the box, and footprints
+// wider than a grid cell (which need few octaves anyway), stay procedural.
 class noise_texture : public texture {
 public:
     noise_texture() {}
     noise_texture(double sc) : scale(sc) {}
 
     virtual color value(double u, double v, const point3& p) const override {
-        return color(1,1,1) * noise.turb(scale * p);
+        return color(1,1,1) * turb(p, 0.0);
     }
 
+    virtual color filtered_value(const hit_record& rec) const override {
+        return color(1,1,1) * turb(rec.p, rec.world_footprint());
+    }
+
+    // Samples turbulence at resolution^3 points spanning box (world space),
+    // stored as floats.
+    noise_bake_report bake(const aabb& box, int resolution);
+
+    bool baked() const { return !grid.empty(); }
+
 public:
     perlin noise;
     double scale;
+
+private:
+    std::vector<float> grid;   // x fastest, then y, then z
+    int grid_resolution = 0;
+    point3 grid_min;
+    vec3 inv_spacing;
+    double max_spacing = 0;
+
+    double turb(const point3& p, double width) const {
+        double baked_value;
+        if (width <= max_spacing && lookup(p, baked_value))
+            return baked_value;
+        return noise.turb_filtered(scale * p, scale * width);
+    }
+
+    // Tricubic reconstruction at p; false outside the grid.
+    bool lookup(const point3& p, double& value) const;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -3,6 +3,8 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <unordered_map>
+#include <tuple>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "thirdparty/tiny_obj_loader.h"
@@ -39,7 +41,35 @@ static vec3 get_normal(const tinyobj::attrib_t& attrib, const tinyobj::index_t&
     return vec3(0, 0, 0);
 }
 
-int load_obj_as_triangles(const std::string& filename, hittable_list& out_world, std::shared_ptr<material> default_mat) {
+static std::vector<vec3> compute_vertex_normals(const tinyobj::attrib_t& attrib,
+                                                const std::vector<tinyobj::shape_t>& shapes) {
+    std::vector<vec3> vertex_normals(attrib.vertices.size() / 3, vec3(0, 0, 0));
+    for (size_t s = 0; s < shapes.size(); ++s) {
+        const tinyobj::mesh_t& mesh = shapes[s].mesh;
+        size_t idx_offset = 0;
+        for (size_t f = 0; f < mesh.num_face_vertices.size(); ++f) {
+            int fv = mesh.num_face_vertices[f];
+            if (fv >= 3) {
+                auto i0 = mesh.indices[idx_offset];
+                auto i1 = mesh.indices[idx_offset + 1];
+                auto i2 = mesh.indices[idx_offset + 2];
+                vec3 face_normal = cross(get_pos(attrib, i1) - get_pos(attrib, i0),
+                                         get_pos(attrib, i2) - get_pos(attrib, i0));
+                vertex_normals[i0.vertex_index] += face_normal;
+                vertex_normals[i1.vertex_index] += face_normal;
+                vertex_normals[i2.vertex_index] += face_normal;
+            }
+            idx_offset += fv;
+        }
+    }
+    for (auto& n : vertex_normals) {
+        if (n.length_squared() > 0)
+            n = unit_vector(n);
+    }
+    return vertex_normals;
+}
+
+int load_obj_as_triangles(const std::string& filename, hittable_list& out_world, const material* default_mat) {
     tinyobj::ObjReaderConfig config;
     config.mtl_search_path = "";
     tinyobj::ObjReader reader;
@@ -52,45 +82,10 @@ int load_obj_as_triangles(const std::string& filename, hittable_list& out_world,
     const auto& attrib = reader.GetAttrib();
     const auto& shapes = reader.GetShapes();
     
-    std::vector<vec3> vertex_normals(attrib.vertices.size() / 3, vec3(0, 0, 0));
-    std::vector<int> vertex_counts(attrib.vertices.size() / 3, 0);
-    
     bool has_normals = !attrib.normals.empty();
-    
-    if (!has_normals) {
-        for (size_t s = 0; s < shapes.size(); ++s) {
-            const tinyobj::mesh_t& mesh = shapes[s].mesh;
-            size_t idx_offset = 0;
-            for (size_t f = 0; f < mesh.num_face_vertices.size(); ++f) {
-                int fv = mesh.num_face_vertices[f];
-                if (fv >= 3) {
-                    auto i0 = mesh.indices[idx_offset];
-                    auto i1 = mesh.indices[idx_offset + 1];
-                    auto i2 = mesh.indices[idx_offset + 2];
-                    
-                    point3 p0 = get_pos(attrib, i0);
-                    point3 p1 = get_pos(attrib, i1);
-                    point3 p2 = get_pos(attrib, i2);
-                    
-                    vec3 face_normal = cross(p1 - p0, p2 - p0);
-                    
-                    vertex_normals[i0.vertex_index] += face_normal;
-                    vertex_normals[i1.vertex_index] += face_normal;
-                    vertex_normals[i2.vertex_index] += face_normal;
-                    vertex_counts[i0.vertex_index]++;
-                    vertex_counts[i1.vertex_index]++;
-                    vertex_counts[i2.vertex_index]++;
-                }
-                idx_offset += fv;
-            }
-        }
-        
-        for (size_t i = 0; i < vertex_normals.size(); ++i) {
-            if (vertex_counts[i] > 0) {
-                vertex_normals[i] = unit_vector(vertex_normals[i]);
-            }
-        }
-    }
+    std::vector<vec3> vertex_normals;
+    if (!has_normals)
+        vertex_normals = compute_vertex_normals(attrib, shapes);
     
     int tri_count = 0;
 
@@ -139,4 +134,85 @@ int load_obj_as_triangles(const std::string& filename, hittable_list& out_world,
         }
     }
     return tri_count;
+}
+
+std::shared_ptr<triangle_mesh> load_obj_as_mesh(const std::string& filename, const material* default_mat) {
+    tinyobj::ObjReaderConfig config;
+    config.mtl_search_path = "";
+    tinyobj::ObjReader reader;
+    if (!reader.ParseFromFile(filename, config)) {
+        if (!reader.Error().empty()) std::cerr << "TinyObjReader error: " << reader.Error() << "\n";
+        return nullptr;
+    }
+    if (!reader.Warning().empty()) std::cerr << "TinyObjReader warning: " << reader.Warning() << "\n";
+
+    const auto& attrib = reader.GetAttrib();
+    const auto& shapes = reader.GetShapes();
+
+    const bool has_normals = !attrib.normals.empty();
+    const bool has_uvs = !attrib.texcoords.empty();
+    std::vector<vec3> vertex_normals;
+    if (!has_normals)
+        vertex_normals = compute_vertex_normals(attrib, shapes);
+
+    // OBJ indexes positions, normals and texcoords separately; every distinct
+    // combination becomes one shared mesh vertex.
+    struct key_hash {
+        size_t operator()(const std::tuple<int, int, int>& k) const {
+            size_t h = std::hash<int>()(std::get<0>(k));
+            h = h * 31 + std::hash<int>()(std::get<1>(k));
+            return h * 31 + std::hash<int>()(std::get<2>(k));
+        }
+    };
+    std::unordered_map<std::tuple<int, int, int>, uint32_t, key_hash> vertex_ids;
+
+    mesh_buffers buffers;
+    auto vertex_id = [&](const tinyobj::index_t& idx) {
+        auto key = std::make_tuple(idx.vertex_index, has_normals ? idx.normal_index : -1,
+                                   has_uvs ? idx.texcoord_index : -1);
+        auto found = vertex_ids.find(key);
+        if (found != vertex_ids.end())
+            return found->second;
+
+        uint32_t id = static_cast<uint32_t>(buffers.px.size());
+        point3 p = get_pos(attrib, idx);
+        buffers.px.push_back(static_cast<float>(p.x()));
+        buffers.py.push_back(static_cast<float>(p.y()));
+        buffers.pz.push_back(static_cast<float>(p.z()));
+
+        vec3 n = has_normals ? get_normal(attrib, idx) : vertex_normals[idx.vertex_index];
+        buffers.nx.push_back(static_cast<float>(n.x()));
+        buffers.ny.push_back(static_cast<float>(n.y()));
+        buffers.nz.push_back(static_cast<float>(n.z()));
+
+        if (has_uvs) {
+            vec2 uv = get_uv(attrib, idx);
+            buffers.u.push_back(static_cast<float>(uv.x()));
+            buffers.v.push_back(static_cast<float>(uv.y()));
+        }
+        vertex_ids.emplace(key, id);
+        return id;
+    };
+
+    for (size_t s = 0; s < shapes.size(); ++s) {
+        const tinyobj::mesh_t& mesh = shapes[s].mesh;
+        size_t idx_offset = 0;
+        for (size_t f = 0; f < mesh.num_face_vertices.size(); ++f) {
+            int fv = mesh.num_face_vertices[f];
+            if (fv >= 3) {
+                uint32_t first = vertex_id(mesh.indices[idx_offset]);
+                for (int k = 1; k < fv - 1; ++k) {
+                    buffers.indices.push_back(first);
+                    buffers.indices.push_back(vertex_id(mesh.indices[idx_offset + k]));
+                    buffers.indices.push_back(vertex_id(mesh.indices[idx_offset + k + 1]));
+                }
+            }
+            idx_offset += fv;
+        }
+    }
+
+    if (buffers.indices.empty())
+        return nullptr;
+
+    return std::make_shared<triangle_mesh>(std::move(buffers), default_mat);
 }
\ No newline at end of file
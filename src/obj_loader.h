@@ -3,6 +3,13 @@
 #include <memory>
 #include "hittable_list.h"
 #include "material.h"
+#include "triangle_mesh.h"
 
 int load_obj_as_triangles(const std::string& filename,
-    hittable_list& out_world,std::shared_ptr<material> default_mat);
\ No newline at end of file
+    hittable_list& out_world,const material* default_mat);
+
+// Loads every face of the OBJ into a single indexed triangle_mesh, sharing
+// vertices between faces. Returns nullptr if the file cannot be parsed or
+// contains no triangles.
+std::shared_ptr<triangle_mesh> load_obj_as_mesh(const std::string& filename,
+    const material* default_mat);
\ No newline at end of file
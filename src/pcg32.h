@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+// PCG32 (O'Neill, pcg-random.org): 64-bit state, 32-bit output. Small enough
+// to keep one per thread and cheap enough to reseed for every sample.
+class pcg32 {
+public:
+    pcg32() : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL) {}
+    pcg32(uint64_t init_state, uint64_t stream = 1) { seed(init_state, stream); }
+
+    void seed(uint64_t init_state, uint64_t stream = 1) {
+        state = 0;
+        inc = (stream << 1) | 1;
+        next_uint();
+        state += init_state;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1) & 31));
+    }
+
+    // Uniform in [0, 1).
+    double next_double() {
+        return next_uint() * (1.0 / 4294967296.0);
+    }
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// SplitMix64 finalizer; turns structured keys (pixel, sample, seed) into
+// well-distributed PCG seeds.
+inline uint64_t mix_bits(uint64_t v) {
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= v >> 33;
+    return v;
+}
+
+inline uint64_t hash_seed(uint64_t a, uint64_t b) {
+    return mix_bits(a ^ mix_bits(b + 0x9e3779b97f4a7c15ULL));
+}
+
+// Each thread owns one generator. The render loop reseeds it per pixel sample,
+// which keeps images identical regardless of thread count or scheduling.
+inline pcg32& thread_rng() {
+    thread_local pcg32 rng;
+    return rng;
+}
@@ -0,0 +1,307 @@
+#include "perlin.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(RT_X86)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+struct noise_tables {
+    const double* grad_x;
+    const double* grad_y;
+    const double* grad_z;
+    const int* perm_x;
+    const int* perm_y;
+    const int* perm_z;
+};
+
+// The kernels below repeat this arithmetic operation for operation, so all
+// of them return bit-identical values unless the compiler contracts the
+// scalar code into FMAs.
+double noise_scalar(const noise_tables& t, const point3& p) {
+    auto u = p.x() - floor(p.x());
+    auto v = p.y() - floor(p.y());
+    auto w = p.z() - floor(p.z());
+
+    int i = static_cast<int>(floor(p.x()));
+    int j = static_cast<int>(floor(p.y()));
+    int k = static_cast<int>(floor(p.z()));
+
+    auto uu = u*u*(3-2*u);
+    auto vv = v*v*(3-2*v);
+    auto ww = w*w*(3-2*w);
+    auto accum = 0.0;
+
+    for (int di=0; di < 2; di++)
+        for (int dj=0; dj < 2; dj++)
+            for (int dk=0; dk < 2; dk++) {
+                int h = t.perm_x[(i+di) & 255] ^ t.perm_y[(j+dj) & 255] ^ t.perm_z[(k+dk) & 255];
+                double dot = t.grad_x[h]*(u-di) + t.grad_y[h]*(v-dj) + t.grad_z[h]*(w-dk);
+                accum += (di ? uu : 1-uu) * (dj ? vv : 1-vv) * (dk ? ww : 1-ww) * dot;
+            }
+
+    return accum;
+}
+
+#if defined(RT_X86)
+// Two points per iteration. SSE2 has neither floor nor gathers, so the
+// lattice cells and table lookups stay scalar and only the blend is vector.
+void noise_sse(const noise_tables& t, const point3* points, double* out, size_t count) {
+    const __m128d one = _mm_set1_pd(1.0), two = _mm_set1_pd(2.0), three = _mm_set1_pd(3.0);
+    size_t n = 0;
+    for (; n + 2 <= count; n += 2) {
+        const point3& a = points[n];
+        const point3& b = points[n + 1];
+        int cell[2][3];
+        __m128d frac[3], weight[3][2];
+        for (int axis = 0; axis < 3; ++axis) {
+            const double fa = floor(a[axis]), fb = floor(b[axis]);
+            cell[0][axis] = static_cast<int>(fa);
+            cell[1][axis] = static_cast<int>(fb);
+            frac[axis] = _mm_set_pd(b[axis] - fb, a[axis] - fa);
+            const __m128d f = frac[axis];
+            const __m128d s = _mm_mul_pd(_mm_mul_pd(f, f), _mm_sub_pd(three, _mm_mul_pd(two, f)));
+            weight[axis][0] = _mm_sub_pd(one, s);
+            weight[axis][1] = s;
+        }
+
+        __m128d accum = _mm_setzero_pd();
+        for (int di=0; di < 2; di++) {
+            const __m128d ox = di ? _mm_sub_pd(frac[0], one) : frac[0];
+            for (int dj=0; dj < 2; dj++) {
+                const __m128d oy = dj ? _mm_sub_pd(frac[1], one) : frac[1];
+                const __m128d wxy = _mm_mul_pd(weight[0][di], weight[1][dj]);
+                for (int dk=0; dk < 2; dk++) {
+                    const __m128d oz = dk ? _mm_sub_pd(frac[2], one) : frac[2];
+                    const int h0 = t.perm_x[(cell[0][0]+di) & 255] ^ t.perm_y[(cell[0][1]+dj) & 255]
+                                 ^ t.perm_z[(cell[0][2]+dk) & 255];
+                    const int h1 = t.perm_x[(cell[1][0]+di) & 255] ^ t.perm_y[(cell[1][1]+dj) & 255]
+                                 ^ t.perm_z[(cell[1][2]+dk) & 255];
+                    const __m128d dot = _mm_add_pd(
+                        _mm_add_pd(_mm_mul_pd(_mm_set_pd(t.grad_x[h1], t.grad_x[h0]), ox),
+                                   _mm_mul_pd(_mm_set_pd(t.grad_y[h1], t.grad_y[h0]), oy)),
+                        _mm_mul_pd(_mm_set_pd(t.grad_z[h1], t.grad_z[h0]), oz));
+                    accum = _mm_add_pd(accum, _mm_mul_pd(_mm_mul_pd(wxy, weight[2][dk]), dot));
+                }
+            }
+        }
+        _mm_storeu_pd(out + n, accum);
+    }
+    for (; n < count; ++n)
+        out[n] = noise_scalar(t, points[n]);
+}
+
+// table[index] in each lane. The masked gather with a zeroed source does
+// the same as _mm256_i32gather_pd, whose undefined source GCC reports under
+// -Wmaybe-uninitialized.
+RT_TARGET_AVX2
+inline __m256d gather_pd(const double* table, __m128i index) {
+    const __m256d all_lanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), table, index, all_lanes, 8);
+}
+
+// Four points per iteration, one per lane: the permutation entries and the
+// gradients of each corner are fetched with gathers.
+RT_TARGET_AVX2
+void noise_avx2(const noise_tables& t, const point3* points, double* out, size_t count) {
+    const __m256d one = _mm256_set1_pd(1.0), two = _mm256_set1_pd(2.0), three = _mm256_set1_pd(3.0);
+    const __m128i wrap = _mm_set1_epi32(255), next = _mm_set1_epi32(1);
+    const int* perm[3] = { t.perm_x, t.perm_y, t.perm_z };
+    size_t n = 0;
+    for (; n + 4 <= count; n += 4) {
+        const point3* p = points + n;
+        __m256d frac[3], weight[3][2];
+        __m128i hash[3][2];
+        for (int axis = 0; axis < 3; ++axis) {
+            const __m256d x = _mm256_set_pd(p[3][axis], p[2][axis], p[1][axis], p[0][axis]);
+            const __m256d fx = _mm256_floor_pd(x);
+            const __m128i cell = _mm256_cvttpd_epi32(fx);
+            frac[axis] = _mm256_sub_pd(x, fx);
+            const __m256d f = frac[axis];
+            const __m256d s = _mm256_mul_pd(_mm256_mul_pd(f, f), _mm256_sub_pd(three, _mm256_mul_pd(two, f)));
+            weight[axis][0] = _mm256_sub_pd(one, s);
+            weight[axis][1] = s;
+            hash[axis][0] = _mm_i32gather_epi32(perm[axis], _mm_and_si128(cell, wrap), 4);
+            hash[axis][1] = _mm_i32gather_epi32(perm[axis], _mm_and_si128(_mm_add_epi32(cell, next), wrap), 4);
+        }
+
+        __m256d accum = _mm256_setzero_pd();
+        for (int di=0; di < 2; di++) {
+            const __m256d ox = di ? _mm256_sub_pd(frac[0], one) : frac[0];
+            for (int dj=0; dj < 2; dj++) {
+                const __m256d oy = dj ? _mm256_sub_pd(frac[1], one) : frac[1];
+                const __m256d wxy = _mm256_mul_pd(weight[0][di], weight[1][dj]);
+                const __m128i hxy = _mm_xor_si128(hash[0][di], hash[1][dj]);
+                for (int dk=0; dk < 2; dk++) {
+                    const __m256d oz = dk ? _mm256_sub_pd(frac[2], one) : frac[2];
+                    const __m128i h = _mm_xor_si128(hxy, hash[2][dk]);
+                    const __m256d dot = _mm256_add_pd(
+                        _mm256_add_pd(_mm256_mul_pd(gather_pd(t.grad_x, h), ox),
+                                      _mm256_mul_pd(gather_pd(t.grad_y, h), oy)),
+                        _mm256_mul_pd(gather_pd(t.grad_z, h), oz));
+                    accum = _mm256_add_pd(accum, _mm256_mul_pd(_mm256_mul_pd(wxy, weight[2][dk]), dot));
+                }
+            }
+        }
+        _mm256_storeu_pd(out + n, accum);
+    }
+    noise_sse(t, points + n, out + n, count - n);
+}
+#endif
+
+}
+
+perlin::perlin(simd_kernel preferred) {
+    for (int i = 0; i < point_count; ++i) {
+        vec3 g = unit_vector(random_vec3(-1,1));
+        grad_x[i] = g.x();
+        grad_y[i] = g.y();
+        grad_z[i] = g.z();
+    }
+
+    perlin_generate_perm(perm_x);
+    perlin_generate_perm(perm_y);
+    perlin_generate_perm(perm_z);
+
+    if (preferred == simd_kernel::avx2 && cpu_has_avx2())
+        noise_kernel = simd_kernel::avx2;
+    else if (preferred != simd_kernel::scalar && cpu_has_sse())
+        noise_kernel = simd_kernel::sse;
+
+    // From a generator of its own, so the tables of perlins made after this
+    // one do not change.
+    pcg32 rng(1);
+    const int samples = 4096;
+    point3 points[max_batch];
+    double values[max_batch];
+    double sum_sq = 0;
+    for (int n = 0; n < samples; n += max_batch) {
+        for (auto& q : points)
+            q = point3(point_count * rng.next_double(), point_count * rng.next_double(), point_count * rng.next_double());
+        noise(points, values, max_batch);
+        for (double v : values)
+            sum_sq += v * v;
+    }
+    noise_variance = sum_sq / samples;
+}
+
+const char* perlin::kernel_name() const {
+    switch (noise_kernel) {
+        case simd_kernel::avx2: return "avx2";
+        case simd_kernel::sse: return "sse";
+        default: return "scalar";
+    }
+}
+
+double perlin::noise(const point3& p) const {
+    return noise_scalar({ grad_x, grad_y, grad_z, perm_x, perm_y, perm_z }, p);
+}
+
+void perlin::noise(const point3* points, double* out, size_t count) const {
+    const noise_tables t = { grad_x, grad_y, grad_z, perm_x, perm_y, perm_z };
+#if defined(RT_X86)
+    if (noise_kernel == simd_kernel::avx2)
+        return noise_avx2(t, points, out, count);
+    if (noise_kernel == simd_kernel::sse)
+        return noise_sse(t, points, out, count);
+#endif
+    for (size_t n = 0; n < count; ++n)
+        out[n] = noise_scalar(t, points[n]);
+}
+
+double perlin::octave_sum(const point3& p, int octaves, double last_weight) const {
+    point3 points[max_batch];
+    double values[max_batch];
+    auto accum = 0.0;
+    auto temp_p = p;
+    auto weight = 1.0;
+
+    for (int first = 0; first < octaves; first += max_batch) {
+        const int batch = std::min(max_batch, octaves - first);
+        // Rounded up to whole SIMD iterations, since the vector kernels cost
+        // the same for a full group as for a partial one.
+        const int padded = std::min(max_batch, (batch + 3) & ~3);
+        for (int i = 0; i < padded; i++) {
+            points[i] = temp_p;
+            temp_p *= 2;
+        }
+        noise(points, values, noise_kernel == simd_kernel::scalar ? batch : padded);
+        for (int i = 0; i < batch; i++) {
+            accum += (first + i == octaves - 1 ? last_weight * weight : weight) * values[i];
+            weight *= 0.5;
+        }
+    }
+
+    return accum;
+}
+
+double perlin::turb(const point3& p, int depth) const {
+    return fabs(octave_sum(p, depth, 1.0));
+}
+
+void perlin::turb(const point3* points, double* out, size_t count, int depth) const {
+    const size_t chunk = 256;
+    point3 scaled[chunk];
+    double values[chunk], accum[chunk];
+    for (size_t first = 0; first < count; first += chunk) {
+        const size_t batch = std::min(chunk, count - first);
+        for (size_t n = 0; n < batch; n++) {
+            scaled[n] = points[first + n];
+            accum[n] = 0.0;
+        }
+        auto weight = 1.0;
+        for (int i = 0; i < depth; i++) {
+            noise(scaled, values, batch);
+            for (size_t n = 0; n < batch; n++) {
+                accum[n] += weight*values[n];
+                scaled[n] *= 2;
+            }
+            weight *= 0.5;
+        }
+        for (size_t n = 0; n < batch; n++)
+            out[first + n] = fabs(accum[n]);
+    }
+}
+
+double perlin::turb_filtered(const point3& p, double width, int depth) const {
+    if (width <= 0)
+        return turb(p, depth);
+    // Octave i has a period of 2^-i and is kept while it spans at least
+    // two widths.
+    double octaves = fmin(fmax(-1 - std::log2(width), 0.0), static_cast<double>(depth));
+    int whole = static_cast<int>(octaves);
+    if (whole == depth)
+        return turb(p, depth);
+    double t = fmin(fmax((octaves - whole - 0.3) / 0.4, 0.0), 1.0);
+    double fade = t*t*(3-2*t);
+    double kept = octave_sum(p, whole + 1, fade);
+    // The dropped octaves (and the faded-out part of the last one kept) add
+    // noise of variance sum(4^-i) * noise_variance. Treating that as Gaussian,
+    // return the expected |kept + dropped|, which goes from |kept| to the
+    // average of turb() as width grows.
+    double dropped_variance = noise_variance
+        * ((1 - fade*fade) * std::ldexp(1.0, -2*whole) + (std::ldexp(1.0, -2*whole) - std::ldexp(1.0, 2 - 2*depth)) / 3);
+    if (dropped_variance <= 0)
+        return fabs(kept);
+    double sigma = std::sqrt(dropped_variance);
+    return sigma * std::sqrt(2 / pi) * std::exp(-kept*kept / (2*dropped_variance))
+         + kept * std::erf(kept / (sigma * std::sqrt(2.0)));
+}
+
+void perlin::perlin_generate_perm(int* p) {
+    for (int i = 0; i < point_count; i++)
+        p[i] = i;
+
+    permute(p, point_count);
+}
+
+void perlin::permute(int* p, int n) {
+    for (int i = n-1; i > 0; i--) {
+        int target = random_int(0, i);
+        int tmp = p[i];
+        p[i] = p[target];
+        p[target] = tmp;
+    }
+}
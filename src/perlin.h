@@ -2,108 +2,58 @@
 #define PERLIN_H
 
 #include "rtweekend.h"
+#include "cpu_features.h"
+#include <cstddef>
 
+// Gradient noise over 256 random gradients and three permutation tables,
+// drawn from the thread's generator. Batches of points are evaluated a few
+// at a time in SIMD lanes (AVX2 with gathers, else SSE2) and give the same
+// values as the scalar noise(); turb() evaluates its octaves as one batch.
 class perlin {
 public:
-    perlin() {
-        ranvec = new vec3[point_count];
-        for (int i = 0; i < point_count; ++i) {
-            ranvec[i] = unit_vector(random_vec3(-1,1));
-        }
+    // Uses the widest kernel the CPU supports, up to preferred.
+    explicit perlin(simd_kernel preferred = simd_kernel::avx2);
 
-        perm_x = perlin_generate_perm();
-        perm_y = perlin_generate_perm();
-        perm_z = perlin_generate_perm();
-    }
+    double noise(const point3& p) const;
 
-    ~perlin() {
-        delete[] ranvec;
-        delete[] perm_x;
-        delete[] perm_y;
-        delete[] perm_z;
-    }
+    // out[i] = noise(points[i]) for i < count.
+    void noise(const point3* points, double* out, size_t count) const;
 
-    double noise(const point3& p) const {
-        auto u = p.x() - floor(p.x());
-        auto v = p.y() - floor(p.y());
-        auto w = p.z() - floor(p.z());
+    double turb(const point3& p, int depth=7) const;
 
-        int i = static_cast<int>(floor(p.x()));
-        int j = static_cast<int>(floor(p.y()));
-        int k = static_cast<int>(floor(p.z()));
-        vec3 c[2][2][2];
+    // out[i] = turb(points[i], depth) for i < count, evaluated one octave at
+    // a time across the whole batch.
+    void turb(const point3* points, double* out, size_t count, int depth=7) const;
 
-        for (int di=0; di < 2; di++)
-            for (int dj=0; dj < 2; dj++)
-                for (int dk=0; dk < 2; dk++)
-                    c[di][dj][dk] = ranvec[
-                        perm_x[(i+di) & 255] ^
-                        perm_y[(j+dj) & 255] ^
-                        perm_z[(k+dk) & 255]
-                    ];
+    // turb() over a footprint width across (in noise space): octaves too
+    // fine to resolve at that width are averaged out instead of aliasing, and
+    // the last one kept fades out smoothly, so fully minified noise settles
+    // at the mean of turb() rather than black. A width of 0 keeps every
+    // octave.
+    double turb_filtered(const point3& p, double width, int depth=7) const;
 
-        return perlin_interp(c, u, v, w);
-    }
-
-    double turb(const point3& p, int depth=7) const {
-        auto accum = 0.0;
-        auto temp_p = p;
-        auto weight = 1.0;
-
-        for (int i = 0; i < depth; i++) {
-            accum += weight*noise(temp_p);
-            weight *= 0.5;
-            temp_p *= 2;
-        }
-
-        return fabs(accum);
-    }
+    simd_kernel kernel() const { return noise_kernel; }
+    const char* kernel_name() const;
 
 private:
     static const int point_count = 256;
-    vec3* ranvec;
-    int* perm_x;
-    int* perm_y;
-    int* perm_z;
-
-    static int* perlin_generate_perm() {
-        auto p = new int[point_count];
-
-        for (int i = 0; i < point_count; i++)
-            p[i] = i;
-
-        permute(p, point_count);
-
-        return p;
-    }
-
-    static void permute(int* p, int n) {
-        for (int i = n-1; i > 0; i--) {
-            int target = random_int(0, i);
-            int tmp = p[i];
-            p[i] = p[target];
-            p[target] = tmp;
-        }
-    }
-
-    static double perlin_interp(vec3 c[2][2][2], double u, double v, double w) {
-        auto uu = u*u*(3-2*u);
-        auto vv = v*v*(3-2*v);
-        auto ww = w*w*(3-2*w);
-        auto accum = 0.0;
-
-        for (int i=0; i < 2; i++)
-            for (int j=0; j < 2; j++)
-                for (int k=0; k < 2; k++) {
-                    vec3 weight_v(u-i, v-j, w-k);
-                    accum += (i*uu + (1-i)*(1-uu))
-                           * (j*vv + (1-j)*(1-vv))
-                           * (k*ww + (1-k)*(1-ww))
-                           * dot(c[i][j][k], weight_v);
-                }
-
-        return accum;
-    }
+    static constexpr int max_batch = 16;
+
+    alignas(32) double grad_x[point_count];
+    alignas(32) double grad_y[point_count];
+    alignas(32) double grad_z[point_count];
+    alignas(32) int perm_x[point_count];
+    alignas(32) int perm_y[point_count];
+    alignas(32) int perm_z[point_count];
+    simd_kernel noise_kernel = simd_kernel::scalar;
+    double noise_variance = 0;   // E[noise(p)^2], estimated at construction
+
+    // Weighted sum of the first octaves of turb() at p; the last one is
+    // scaled by last_weight.
+    double octave_sum(const point3& p, int octaves, double last_weight) const;
+
+    static void perlin_generate_perm(int* p);
+    static void permute(int* p, int n);
 };
 
-#endif
\ No newline at end of file
+#endif
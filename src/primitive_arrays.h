@@ -0,0 +1,191 @@
+#pragma once
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+#include "moving_sphere.h"
+#include "triangle.h"
+#include "quad.h"
+#include <cstdint>
+#include <memory>
+#include <typeinfo>
+#include <vector>
+
+enum class primitive_type : uint8_t { sphere, moving_sphere, triangle, quad, custom };
+
+// A BVH leaf entry: which array and where in it.
+struct primitive_ref {
+    uint32_t index;
+    primitive_type type;
+};
+
+// Alternative scene representation that keeps each built-in primitive type in
+// its own array and dispatches leaf tests with a switch, so the intersection
+// routines are called directly and can be inlined. The arrays point at the
+// scene's own objects (kept alive here), so rec.object is the same pointer
+// the light list knows them by. Anything
+// else (meshes, instances, media, user types) is kept as a custom primitive
+// and goes through the virtual interface as before. Nested hittable_lists
+// are flattened.
+class primitive_arrays : public hittable {
+public:
+    primitive_arrays() {}
+
+    primitive_arrays(const hittable_list& list, const bvh_build_options& options = bvh_build_options()) {
+        add_all(list);
+
+        std::vector<bvh_primitive> prims;
+        prims.reserve(refs.size());
+        for (size_t i = 0; i < refs.size(); ++i) {
+            aabb ref_box;
+            if (!bounding_box_of(refs[i], ref_box))
+                std::cerr << "No bounding box in primitive_arrays constructor.\n";
+            prims.push_back({ref_box, ref_box.centroid(), i});
+        }
+
+        if (prims.empty())
+            return;
+
+        build_linear_bvh(prims, 0, prims.size(), options, nodes);
+        box = primitive_bounds(prims, 0, prims.size());
+
+        std::vector<primitive_ref> ordered;
+        ordered.reserve(refs.size());
+        for (const auto& p : prims)
+            ordered.push_back(refs[p.index]);
+        refs.swap(ordered);
+    }
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        if (nodes.empty())
+            return false;
+
+        return traverse_linear_bvh(nodes.data(), r, t_min, t_max,
+            [&](uint32_t first, uint32_t count, double& closest) {
+                bool hit_anything = false;
+                for (uint32_t i = first; i < first + count; ++i) {
+                    if (hit_ref(refs[i], r, t_min, closest, rec)) {
+                        hit_anything = true;
+                        closest = rec.t;
+                    }
+                }
+                return hit_anything;
+            });
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        if (nodes.empty())
+            return false;
+
+        return traverse_linear_bvh<true>(nodes.data(), r, t_min, t_max,
+            [&](uint32_t first, uint32_t count, double& closest) {
+                for (uint32_t i = first; i < first + count; ++i) {
+                    if (occluded_ref(refs[i], r, t_min, closest))
+                        return true;
+                }
+                return false;
+            });
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        double result = 1.0;
+        for (const hittable* medium : media)
+            result *= medium->transmittance(r, t_min, t_max);
+        return result;
+    }
+
+    virtual bool has_media() const override { return !media.empty(); }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        if (nodes.empty()) return false;
+        output_box = box;
+        return true;
+    }
+
+    size_t count(primitive_type type) const {
+        switch (type) {
+            case primitive_type::sphere: return spheres.size();
+            case primitive_type::moving_sphere: return moving_spheres.size();
+            case primitive_type::triangle: return triangles.size();
+            case primitive_type::quad: return quads.size();
+            default: return custom.size();
+        }
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+private:
+    std::vector<const sphere*> spheres;
+    std::vector<const moving_sphere*> moving_spheres;
+    std::vector<const triangle*> triangles;
+    std::vector<const quad*> quads;
+    std::vector<const hittable*> custom;
+    std::vector<std::shared_ptr<hittable>> owned;
+    std::vector<const hittable*> media;   // the custom entries that have any
+
+    std::vector<primitive_ref> refs;
+    std::vector<linear_bvh_node> nodes;
+    aabb box;
+
+    // Exact type matches only: a user subclass of sphere may override hit.
+    void add_all(const hittable_list& list) {
+        for (const auto& object : list.objects) {
+            const hittable& h = *object;
+            if (typeid(h) == typeid(hittable_list)) {
+                add_all(static_cast<const hittable_list&>(h));
+                continue;
+            }
+            owned.push_back(object);
+            if (typeid(h) == typeid(sphere))
+                push(spheres, static_cast<const sphere*>(&h), primitive_type::sphere);
+            else if (typeid(h) == typeid(moving_sphere))
+                push(moving_spheres, static_cast<const moving_sphere*>(&h), primitive_type::moving_sphere);
+            else if (typeid(h) == typeid(triangle))
+                push(triangles, static_cast<const triangle*>(&h), primitive_type::triangle);
+            else if (typeid(h) == typeid(quad))
+                push(quads, static_cast<const quad*>(&h), primitive_type::quad);
+            else {
+                push(custom, &h, primitive_type::custom);
+                if (h.has_media())
+                    media.push_back(&h);
+            }
+        }
+    }
+
+    template <typename T>
+    void push(std::vector<const T*>& array, const T* value, primitive_type type) {
+        refs.push_back({static_cast<uint32_t>(array.size()), type});
+        array.push_back(value);
+    }
+
+    // Qualified calls bind statically, so each case is a direct (inlinable) call.
+    bool hit_ref(primitive_ref ref, const ray& r, double t_min, double t_max, hit_record& rec) const {
+        switch (ref.type) {
+            case primitive_type::sphere: return spheres[ref.index]->sphere::hit(r, t_min, t_max, rec);
+            case primitive_type::moving_sphere: return moving_spheres[ref.index]->moving_sphere::hit(r, t_min, t_max, rec);
+            case primitive_type::triangle: return triangles[ref.index]->triangle::hit(r, t_min, t_max, rec);
+            case primitive_type::quad: return quads[ref.index]->quad::hit(r, t_min, t_max, rec);
+            default: return custom[ref.index]->hit(r, t_min, t_max, rec);
+        }
+    }
+
+    bool occluded_ref(primitive_ref ref, const ray& r, double t_min, double t_max) const {
+        switch (ref.type) {
+            case primitive_type::sphere: return spheres[ref.index]->sphere::occluded(r, t_min, t_max);
+            case primitive_type::moving_sphere: return moving_spheres[ref.index]->moving_sphere::occluded(r, t_min, t_max);
+            case primitive_type::triangle: return triangles[ref.index]->triangle::occluded(r, t_min, t_max);
+            case primitive_type::quad: return quads[ref.index]->quad::occluded(r, t_min, t_max);
+            default: return custom[ref.index]->occluded(r, t_min, t_max);
+        }
+    }
+
+    bool bounding_box_of(primitive_ref ref, aabb& output_box) const {
+        switch (ref.type) {
+            case primitive_type::sphere: return spheres[ref.index]->bounding_box(output_box);
+            case primitive_type::moving_sphere: return moving_spheres[ref.index]->bounding_box(output_box);
+            case primitive_type::triangle: return triangles[ref.index]->bounding_box(output_box);
+            case primitive_type::quad: return quads[ref.index]->bounding_box(output_box);
+            default: return custom[ref.index]->bounding_box(output_box);
+        }
+    }
+};
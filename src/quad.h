@@ -3,16 +3,88 @@
 
 #include "hittable.h"
 #include "vec3.h"
+#include "rtweekend.h"
 
 class quad : public hittable {
 public:
     quad() {}
     
-    quad(point3 _min, point3 _max, std::shared_ptr<material> m, int axis_type = 2)
+    quad(point3 _min, point3 _max, const material* m, int axis_type = 2)
         : box_min(_min), box_max(_max), mat_ptr(m), axis(axis_type) {}
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        double t, u, v;
+        if (!intersect(r, t_min, t_max, t, u, v))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        
+        vec3 outward_normal;
+        if (axis == 0) outward_normal = vec3(1, 0, 0);
+        else if (axis == 1) outward_normal = vec3(0, 1, 0);
+        else outward_normal = vec3(0, 0, 1);
         
+        rec.set_face_normal(r, outward_normal);
+        rec.mat_ptr = mat_ptr;
+        rec.object = this;
+        rec.u = u;
+        rec.v = v;
+        vec3 dpdu, dpdv;
+        dpdu[axis_a()] = box_max[axis_a()] - box_min[axis_a()];
+        dpdv[axis_b()] = box_max[axis_b()] - box_min[axis_b()];
+        rec.set_partials(dpdu, dpdv, vec3(), vec3());
+
+        return true;
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        double t, u, v;
+        return intersect(r, t_min, t_max, t, u, v);
+    }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        const double epsilon = 0.0001;
+        point3 pad_min = box_min - vec3(epsilon, epsilon, epsilon);
+        point3 pad_max = box_max + vec3(epsilon, epsilon, epsilon);
+        output_box = aabb(pad_min, pad_max);
+        return true;
+    }
+
+    virtual double pdf_value(const point3& origin, const vec3& direction) const override {
+        double t, u, v;
+        if (!intersect(ray(origin, direction), 0.001, infinity, t, u, v))
+            return 0.0;
+        double dist_sq = t * t * direction.length_squared();
+        double cosine = std::fabs(direction[axis]) / direction.length();
+        return dist_sq / (cosine * area());
+    }
+
+    virtual vec3 random(const point3& origin, const vec2& u) const override {
+        point3 p = box_min;
+        p[axis_a()] += u.x() * (box_max[axis_a()] - box_min[axis_a()]);
+        p[axis_b()] += u.y() * (box_max[axis_b()] - box_min[axis_b()]);
+        return p - origin;
+    }
+
+    virtual const material* surface_material() const override { return mat_ptr; }
+
+    virtual bool normal_bounds(vec3& axis_normal, double& cos_theta) const override {
+        axis_normal = vec3(0, 0, 0);
+        axis_normal[axis] = 1;
+        cos_theta = 1;
+        return true;
+    }
+
+    virtual double area() const override {
+        return (box_max[axis_a()] - box_min[axis_a()]) * (box_max[axis_b()] - box_min[axis_b()]);
+    }
+
+private:
+    int axis_a() const { return axis == 0 ? 1 : 0; }
+    int axis_b() const { return axis == 2 ? 1 : 2; }
+
+    bool intersect(const ray& r, double t_min, double t_max, double& t, double& u, double& v) const {
         int a_axis, b_axis;
         if (axis == 0) { a_axis = 1; b_axis = 2; }
         else if (axis == 1) { a_axis = 0; b_axis = 2; }
@@ -29,7 +101,7 @@ public:
         if (fabs(ray_dir_component) < 1e-8)
             return false;
 
-        double t = (k - ray_orig_component) / ray_dir_component;
+        t = (k - ray_orig_component) / ray_dir_component;
         if (t < t_min || t > t_max)
             return false;
 
@@ -45,33 +117,13 @@ public:
         if (p_a < min_a || p_a > max_a || p_b < min_b || p_b > max_b)
             return false;
 
-        rec.t = t;
-        rec.p = p;
-        
-        vec3 outward_normal;
-        if (axis == 0) outward_normal = vec3(1, 0, 0);
-        else if (axis == 1) outward_normal = vec3(0, 1, 0);
-        else outward_normal = vec3(0, 0, 1);
-        
-        rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mat_ptr;
-        rec.u = (p_a - min_a) / (max_a - min_a);
-        rec.v = (p_b - min_b) / (max_b - min_b);
-
+        u = (p_a - min_a) / (max_a - min_a);
+        v = (p_b - min_b) / (max_b - min_b);
         return true;
     }
 
-    virtual bool bounding_box(aabb& output_box) const override {
-        const double epsilon = 0.0001;
-        point3 pad_min = box_min - vec3(epsilon, epsilon, epsilon);
-        point3 pad_max = box_max + vec3(epsilon, epsilon, epsilon);
-        output_box = aabb(pad_min, pad_max);
-        return true;
-    }
-
-private:
     point3 box_min, box_max;
-    std::shared_ptr<material> mat_ptr;
+    const material* mat_ptr;
     int axis;
 };
 
@@ -1,6 +1,13 @@
 #pragma once
 #include "vec3.h"
 
+// Rays offset by one pixel in x and y from a main ray, carried alongside it
+// so hits can estimate how much of the surface a pixel covers.
+struct ray_differentials {
+    point3 rx_origin, ry_origin;
+    vec3 rx_direction, ry_direction;
+};
+
 class ray {
 public:
     ray() {}
@@ -13,8 +20,18 @@ public:
 
     point3 at(double t) const { return orig + t*dir; }
 
+    bool has_differentials() const { return differentials_set; }
+    const ray_differentials& differentials() const { return diff; }
+
+    void set_differentials(const ray_differentials& d) {
+        diff = d;
+        differentials_set = true;
+    }
+
 private:
     point3 orig;
     vec3 dir;
     double tm;
-};
\ No newline at end of file
+    bool differentials_set = false;
+    ray_differentials diff;
+};
@@ -4,6 +4,7 @@
 #include <memory>
 #include <random>
 #include "vec3.h"
+#include "pcg32.h"
 
 const double infinity = std::numeric_limits<double>::infinity();
 const double pi = 3.1415926535897932385;
@@ -12,42 +13,42 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
-inline double random_double() {
-    return rand() / (RAND_MAX + 1.0);
+inline double random_double(pcg32& rng = thread_rng()) {
+    return rng.next_double();
 }
 
-inline double random_double(double min, double max) {
-    return min + (max - min) * random_double();
+inline double random_double(double min, double max, pcg32& rng = thread_rng()) {
+    return min + (max - min) * random_double(rng);
 }
 
-inline vec3 random_in_unit_sphere() {
+inline vec3 random_in_unit_sphere(pcg32& rng = thread_rng()) {
     while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), random_double(-1,1));
+        auto p = vec3(random_double(-1,1,rng), random_double(-1,1,rng), random_double(-1,1,rng));
         if (p.length_squared() >= 1) continue;
         return p;
     }
 }
 
-inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+inline vec3 random_unit_vector(pcg32& rng = thread_rng()) {
+    return unit_vector(random_in_unit_sphere(rng));
 }
 
-inline int random_int(int min, int max) {
-    return static_cast<int>(random_double(min, max+1));
+inline int random_int(int min, int max, pcg32& rng = thread_rng()) {
+    return static_cast<int>(random_double(min, max+1, rng));
 }
 
-inline vec3 random_in_unit_disk() {
+inline vec3 random_in_unit_disk(pcg32& rng = thread_rng()) {
     while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
+        auto p = vec3(random_double(-1,1,rng), random_double(-1,1,rng), 0);
         if (p.length_squared() < 1)
             return p;
     }
 }
 
-inline vec3 random_vec3() {
-    return vec3(random_double(), random_double(), random_double());
+inline vec3 random_vec3(pcg32& rng = thread_rng()) {
+    return vec3(random_double(rng), random_double(rng), random_double(rng));
 }
 
-inline vec3 random_vec3(double min, double max) {
-    return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
+inline vec3 random_vec3(double min, double max, pcg32& rng = thread_rng()) {
+    return vec3(random_double(min,max,rng), random_double(min,max,rng), random_double(min,max,rng));
 }
\ No newline at end of file
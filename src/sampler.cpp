@@ -0,0 +1,291 @@
+#include "sampler.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+const double one_minus_epsilon = 0x1.fffffffffffffp-1;
+
+double to_unit(uint32_t bits) {
+    return bits * (1.0 / 4294967296.0);
+}
+
+uint64_t pixel_key(int x, int y) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32) | static_cast<uint32_t>(x);
+}
+
+uint32_t hash32(uint64_t a, uint64_t b) {
+    return static_cast<uint32_t>(hash_seed(a, b) >> 32);
+}
+
+// Kensler's hashed permutation of [0, length) and per-index jitter.
+uint32_t permute(uint32_t i, uint32_t length, uint32_t p) {
+    uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + p) % length;
+}
+
+double jitter(uint32_t i, uint32_t p) {
+    i ^= p;
+    i ^= i >> 17;
+    i ^= i >> 10;
+    i *= 0xb36534e5;
+    i ^= i >> 12;
+    i ^= i >> 21;
+    i *= 0x93fc4795;
+    i ^= 0xdf6e307f;
+    i ^= i >> 17;
+    i *= 1 | p >> 18;
+    return to_unit(i);
+}
+
+uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+// Second Sobol dimension (primitive polynomial x + 1); the first is the
+// bit-reversed index.
+uint32_t sobol_dim1(uint32_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1)
+            result ^= v;
+    }
+    return result;
+}
+
+// Burley's hash-based Owen scrambling: a Laine-Karras style permutation that
+// only propagates bits upward, applied to the bit-reversed value.
+uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return reverse_bits(x);
+}
+
+// Point `index` of a shuffled, scrambled (0,2)-sequence; seed selects the
+// randomization.
+vec2 scrambled_sobol_2d(uint32_t index, uint64_t seed) {
+    uint32_t i = nested_uniform_scramble(index, hash32(seed, 0));
+    uint32_t x = nested_uniform_scramble(reverse_bits(i), hash32(seed, 1));
+    uint32_t y = nested_uniform_scramble(sobol_dim1(i), hash32(seed, 2));
+    return vec2(to_unit(x), to_unit(y));
+}
+
+double scrambled_sobol_1d(uint32_t index, uint64_t seed) {
+    uint32_t i = nested_uniform_scramble(index, hash32(seed, 0));
+    return to_unit(nested_uniform_scramble(reverse_bits(i), hash32(seed, 1)));
+}
+
+const int blue_noise_size = 64;
+
+// Void-and-cluster (Ulichney 1993) rank mask on a torus, values in (0, 1).
+std::vector<float> make_blue_noise_mask(int size, uint64_t seed) {
+    const int n = size * size;
+    const double sigma = 1.5;
+
+    std::vector<double> kernel(n);
+    for (int dy = 0; dy < size; ++dy) {
+        for (int dx = 0; dx < size; ++dx) {
+            int wx = std::min(dx, size - dx);
+            int wy = std::min(dy, size - dy);
+            kernel[dy * size + dx] = std::exp(-(wx * wx + wy * wy) / (2.0 * sigma * sigma));
+        }
+    }
+
+    std::vector<char> bits(n, 0);
+    std::vector<double> energy(n, 0.0);
+    auto toggle = [&](int p, bool on) {
+        bits[p] = on;
+        const double sign = on ? 1.0 : -1.0;
+        const int px = p % size, py = p / size;
+        for (int y = 0; y < size; ++y) {
+            const double* row = &kernel[((y - py + size) % size) * size];
+            for (int x = 0; x < size; ++x)
+                energy[y * size + x] += sign * row[(x - px + size) % size];
+        }
+    };
+    auto tightest_cluster = [&]() {
+        int best = -1;
+        for (int p = 0; p < n; ++p)
+            if (bits[p] && (best < 0 || energy[p] > energy[best])) best = p;
+        return best;
+    };
+    auto largest_void = [&]() {
+        int best = -1;
+        for (int p = 0; p < n; ++p)
+            if (!bits[p] && (best < 0 || energy[p] < energy[best])) best = p;
+        return best;
+    };
+
+    pcg32 rng(seed);
+    const int initial = n / 10;
+    for (int placed = 0; placed < initial;) {
+        int p = static_cast<int>(rng.next_uint() % n);
+        if (!bits[p]) {
+            toggle(p, true);
+            placed++;
+        }
+    }
+
+    // Move points from the tightest cluster into the largest void until stable.
+    for (int iter = 0; iter < n; ++iter) {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        int hole = largest_void();
+        toggle(hole, true);
+        if (hole == cluster) break;
+    }
+
+    std::vector<int> rank(n);
+    const std::vector<char> prototype_bits = bits;
+    const std::vector<double> prototype_energy = energy;
+    for (int r = initial - 1; r >= 0; --r) {
+        int cluster = tightest_cluster();
+        toggle(cluster, false);
+        rank[cluster] = r;
+    }
+
+    // Filling the largest void among zeros is the same as removing the
+    // tightest cluster of zeros, so one loop covers both remaining phases.
+    bits = prototype_bits;
+    energy = prototype_energy;
+    for (int r = initial; r < n; ++r) {
+        int hole = largest_void();
+        toggle(hole, true);
+        rank[hole] = r;
+    }
+
+    std::vector<float> mask(n);
+    for (int p = 0; p < n; ++p)
+        mask[p] = (rank[p] + 0.5f) / n;
+    return mask;
+}
+
+const float* blue_noise_mask() {
+    static const std::vector<float> mask = make_blue_noise_mask(blue_noise_size, 0x5eed);
+    return mask.data();
+}
+
+} // namespace
+
+void independent_sampler::start_pixel_sample(int x, int y, int index) {
+    rng.seed(hash_seed(seed, pixel_key(x, y)), static_cast<uint64_t>(index));
+    dimension = 0;
+}
+
+stratified_sampler::stratified_sampler(int samples_per_pixel, uint64_t seed)
+    : count(static_cast<uint32_t>(std::max(1, samples_per_pixel))), seed(seed) {
+    grid_x = std::max<uint32_t>(1, static_cast<uint32_t>(std::sqrt(static_cast<double>(count))));
+    grid_y = (count + grid_x - 1) / grid_x;
+}
+
+void stratified_sampler::start_pixel_sample(int x, int y, int index) {
+    pixel_seed = hash_seed(seed, pixel_key(x, y));
+    sample_index = static_cast<uint32_t>(index) % count;
+    dimension = 0;
+}
+
+double stratified_sampler::sample_1d(int dim) {
+    uint32_t p = hash32(pixel_seed, static_cast<uint64_t>(dim));
+    double u = (permute(sample_index, count, p) + jitter(sample_index, p * 0x68bc21eb)) / count;
+    return std::min(u, one_minus_epsilon);
+}
+
+vec2 stratified_sampler::sample_2d(int dim) {
+    // Each sample sits in its own cell of a grid_x x grid_y grid and in its
+    // own column/row of the fine grid inside the cells.
+    const uint32_t p = hash32(pixel_seed, static_cast<uint64_t>(dim));
+    const uint32_t s = permute(sample_index, count, p * 0x51633e2d);
+    const uint32_t cx = s % grid_x, cy = s / grid_x;
+    const uint32_t sx = permute(cx, grid_x, p * 0x68bc21eb);
+    const uint32_t sy = permute(cy, grid_y, p * 0x02e5be93);
+    const double jx = jitter(s, p * 0x967a889b);
+    const double jy = jitter(s, p * 0x368cc8b7);
+    double u = (cx + (sy + jx) / grid_y) / grid_x;
+    double v = (cy + (sx + jy) / grid_x) / grid_y;
+    return vec2(std::min(u, one_minus_epsilon), std::min(v, one_minus_epsilon));
+}
+
+void sobol_sampler::start_pixel_sample(int x, int y, int index) {
+    pixel_seed = hash_seed(seed, pixel_key(x, y));
+    sample_index = static_cast<uint32_t>(index);
+    dimension = 0;
+}
+
+double sobol_sampler::sample_1d(int dim) {
+    return scrambled_sobol_1d(sample_index, hash_seed(pixel_seed, static_cast<uint64_t>(dim)));
+}
+
+vec2 sobol_sampler::sample_2d(int dim) {
+    return scrambled_sobol_2d(sample_index, hash_seed(pixel_seed, static_cast<uint64_t>(dim)));
+}
+
+blue_noise_sampler::blue_noise_sampler(uint64_t seed) : seed(seed), mask(blue_noise_mask()) {}
+
+void blue_noise_sampler::start_pixel_sample(int x, int y, int index) {
+    px = x;
+    py = y;
+    sample_index = static_cast<uint32_t>(index);
+    dimension = 0;
+}
+
+double blue_noise_sampler::mask_value(int dim) const {
+    const uint32_t offset = hash32(seed, static_cast<uint64_t>(dim) + 0x9e37);
+    const int x = (px + static_cast<int>(offset & 0xffff)) & (blue_noise_size - 1);
+    const int y = (py + static_cast<int>(offset >> 16)) & (blue_noise_size - 1);
+    return mask[y * blue_noise_size + x];
+}
+
+double blue_noise_sampler::sample_1d(int dim) {
+    double u = scrambled_sobol_1d(sample_index, hash_seed(seed, static_cast<uint64_t>(dim))) + mask_value(dim);
+    return std::min(u - std::floor(u), one_minus_epsilon);
+}
+
+vec2 blue_noise_sampler::sample_2d(int dim) {
+    vec2 u = scrambled_sobol_2d(sample_index, hash_seed(seed, static_cast<uint64_t>(dim)));
+    double a = u.x() + mask_value(dim);
+    double b = u.y() + mask_value(dim + 1);
+    return vec2(std::min(a - std::floor(a), one_minus_epsilon), std::min(b - std::floor(b), one_minus_epsilon));
+}
+
+std::unique_ptr<sampler> make_sampler(sampler_type type, int samples_per_pixel, uint64_t seed) {
+    switch (type) {
+        case sampler_type::stratified: return std::make_unique<stratified_sampler>(samples_per_pixel, seed);
+        case sampler_type::sobol: return std::make_unique<sobol_sampler>(seed);
+        case sampler_type::blue_noise: return std::make_unique<blue_noise_sampler>(seed);
+        default: return std::make_unique<independent_sampler>(seed);
+    }
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include "vec2.h"
+#include "vec3.h"
+#include "pcg32.h"
+#include "rtweekend.h"
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+// Source of sample values for one pixel sample at a time. Each call consumes
+// the next dimension; the integrator calls set_dimension() at fixed offsets so
+// that a given dimension always drives the same decision (e.g. the lens
+// sample, or the light sample at bounce 2), which is what lets stratified and
+// low-discrepancy points stay well distributed across a pixel's samples.
+class sampler {
+public:
+    virtual ~sampler() {}
+
+    // Begins sample `index` of pixel (x, y) at dimension 0.
+    virtual void start_pixel_sample(int x, int y, int index) = 0;
+
+    void set_dimension(int d) { dimension = d; }
+
+    double get_1d() { return sample_1d(dimension++); }
+
+    vec2 get_2d() {
+        vec2 u = sample_2d(dimension);
+        dimension += 2;
+        return u;
+    }
+
+    // Each render thread works on its own copy.
+    virtual std::unique_ptr<sampler> clone() const = 0;
+    virtual const char* name() const = 0;
+
+protected:
+    virtual double sample_1d(int dim) = 0;
+    virtual vec2 sample_2d(int dim) = 0;
+
+    int dimension = 0;
+};
+
+// Plain PCG32 draws, seeded per pixel sample.
+class independent_sampler : public sampler {
+public:
+    explicit independent_sampler(uint64_t seed = 0) : seed(seed) {}
+
+    virtual void start_pixel_sample(int x, int y, int index) override;
+    virtual std::unique_ptr<sampler> clone() const override { return std::make_unique<independent_sampler>(*this); }
+    virtual const char* name() const override { return "independent"; }
+
+protected:
+    virtual double sample_1d(int dim) override { return rng.next_double(); }
+    virtual vec2 sample_2d(int dim) override {
+        double a = rng.next_double();
+        return vec2(a, rng.next_double());
+    }
+
+private:
+    uint64_t seed;
+    pcg32 rng;
+};
+
+// Jittered strata over the pixel's samples_per_pixel samples: 1D dimensions
+// are Latin-hypercube stratified, 2D dimensions use correlated multi-jittered
+// points (Kensler 2013), each shuffled independently per pixel and dimension.
+class stratified_sampler : public sampler {
+public:
+    stratified_sampler(int samples_per_pixel, uint64_t seed = 0);
+
+    virtual void start_pixel_sample(int x, int y, int index) override;
+    virtual std::unique_ptr<sampler> clone() const override { return std::make_unique<stratified_sampler>(*this); }
+    virtual const char* name() const override { return "stratified"; }
+
+protected:
+    virtual double sample_1d(int dim) override;
+    virtual vec2 sample_2d(int dim) override;
+
+private:
+    uint32_t count;
+    uint32_t grid_x, grid_y;
+    uint64_t seed;
+    uint64_t pixel_seed = 0;
+    uint32_t sample_index = 0;
+};
+
+// Padded (0,2)-sequence: the first two Sobol dimensions, with the sample
+// index shuffled and the points nested-uniform (Owen) scrambled per pixel and
+// dimension pair (Burley 2020). Good at any sample count, best at powers of two.
+class sobol_sampler : public sampler {
+public:
+    explicit sobol_sampler(uint64_t seed = 0) : seed(seed) {}
+
+    virtual void start_pixel_sample(int x, int y, int index) override;
+    virtual std::unique_ptr<sampler> clone() const override { return std::make_unique<sobol_sampler>(*this); }
+    virtual const char* name() const override { return "sobol"; }
+
+protected:
+    virtual double sample_1d(int dim) override;
+    virtual vec2 sample_2d(int dim) override;
+
+private:
+    uint64_t seed;
+    uint64_t pixel_seed = 0;
+    uint32_t sample_index = 0;
+};
+
+// One scrambled Sobol sequence shared by every pixel, rotated per pixel by a
+// blue-noise mask (Cranley-Patterson rotation) so that the remaining error is
+// pushed to high screen-space frequencies. Each dimension reads the mask at
+// its own toroidal offset.
+class blue_noise_sampler : public sampler {
+public:
+    explicit blue_noise_sampler(uint64_t seed = 0);
+
+    virtual void start_pixel_sample(int x, int y, int index) override;
+    virtual std::unique_ptr<sampler> clone() const override { return std::make_unique<blue_noise_sampler>(*this); }
+    virtual const char* name() const override { return "blue-noise"; }
+
+protected:
+    virtual double sample_1d(int dim) override;
+    virtual vec2 sample_2d(int dim) override;
+
+private:
+    uint64_t seed;
+    const float* mask;
+    int px = 0, py = 0;
+    uint32_t sample_index = 0;
+
+    double mask_value(int dim) const;
+};
+
+enum class sampler_type { independent, stratified, sobol, blue_noise };
+
+std::unique_ptr<sampler> make_sampler(sampler_type type, int samples_per_pixel, uint64_t seed = 0);
+
+// Warps from [0,1)^2 onto common domains.
+
+inline vec3 sample_unit_sphere(const vec2& u) {
+    double z = 1.0 - 2.0 * u.x();
+    double r = std::sqrt(std::fmax(0.0, 1.0 - z * z));
+    double phi = 2.0 * pi * u.y();
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Shirley-Chiu concentric mapping; keeps strata compact on the disk.
+inline vec3 sample_unit_disk(const vec2& u) {
+    double a = 2.0 * u.x() - 1.0;
+    double b = 2.0 * u.y() - 1.0;
+    if (a == 0 && b == 0)
+        return vec3(0, 0, 0);
+    double r, theta;
+    if (std::fabs(a) > std::fabs(b)) {
+        r = a;
+        theta = (pi / 4) * (b / a);
+    } else {
+        r = b;
+        theta = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(r * std::cos(theta), r * std::sin(theta), 0);
+}
+
+// Uniform in the unit ball: a direction plus a cube-root radius.
+inline vec3 sample_unit_ball(const vec2& u, double w) {
+    return std::cbrt(w) * sample_unit_sphere(u);
+}
+
+// Cosine-weighted direction about +z.
+inline vec3 sample_cosine_hemisphere(const vec2& u) {
+    double phi = 2.0 * pi * u.x();
+    double r = std::sqrt(u.y());
+    return vec3(std::cos(phi) * r, std::sin(phi) * r, std::sqrt(std::fmax(0.0, 1.0 - u.y())));
+}
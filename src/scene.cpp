@@ -0,0 +1,586 @@
+#include "scene.h"
+#include "checker_texture.h"
+#include "constant_medium.h"
+#include "dielectric.h"
+#include "emissive.h"
+#include "grid_medium.h"
+#include "image_texture.h"
+#include "lambertian.h"
+#include "mesh_cache.h"
+#include "metal.h"
+#include "moving_sphere.h"
+#include "noise_texture.h"
+#include "obj_loader.h"
+#include "quad.h"
+#include "solid_color.h"
+#include "sphere.h"
+#include "transform.h"
+#include "triangle.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+// The tokens of one statement. Reads past the end or of the wrong type
+// record an error (the first one wins) and return a zero value, so parsing
+// code can read everything it needs and check ok() once.
+class statement {
+public:
+    statement(std::vector<std::string> words, int line) : line(line), tokens(std::move(words)) {}
+
+    bool at_end() const { return next >= tokens.size(); }
+    bool peek(const char* word) const { return !at_end() && tokens[next] == word; }
+
+    std::string word(const char* what) {
+        if (at_end()) {
+            fail(std::string("expected ") + what);
+            return std::string();
+        }
+        return tokens[next++];
+    }
+
+    double number(const char* what) {
+        const std::string token = word(what);
+        if (token.empty())
+            return 0.0;
+        char* end = nullptr;
+        const double value = std::strtod(token.c_str(), &end);
+        if (*end != '\0') {
+            fail(std::string("expected ") + what + ", got '" + token + "'");
+            return 0.0;
+        }
+        return value;
+    }
+
+    int integer(const char* what) {
+        const double value = number(what);
+        if (value != static_cast<int>(value)) {
+            fail(std::string("expected a whole number for ") + what);
+            return 0;
+        }
+        return static_cast<int>(value);
+    }
+
+    vec3 triple(const char* what) {
+        const double x = number(what);
+        const double y = number(what);
+        return vec3(x, y, number(what));
+    }
+
+    void fail(const std::string& message) {
+        if (error.empty())
+            error = message;
+    }
+
+    // Flags leftover tokens; true if the statement parsed cleanly.
+    bool finish() {
+        if (!at_end())
+            fail("unexpected '" + tokens[next] + "'");
+        return ok();
+    }
+
+    bool ok() const { return error.empty(); }
+
+    const int line;
+    std::string error;
+
+private:
+    std::vector<std::string> tokens;
+    size_t next = 0;
+};
+
+class scene_builder {
+public:
+    scene_builder(scene& out, const std::string& path) : out(out) {
+        const size_t slash = path.find_last_of('/');
+        directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    }
+
+    void parse(statement& st) {
+        const std::string keyword = st.word("a statement");
+        if (keyword == "render") parse_render(st);
+        else if (keyword == "camera") parse_camera(st);
+        else if (keyword == "output") parse_output(st);
+        else if (keyword == "texture") parse_texture(st);
+        else if (keyword == "material") parse_material(st);
+        else if (keyword == "define") parse_define(st);
+        else if (keyword == "add") add(named_shape(st));
+        else if (keyword == "instance") parse_instance(st);
+        else add(parse_shape(keyword, st));
+        st.finish();
+    }
+
+    // Settings that depend on each other once every statement is in.
+    bool finish(std::string& error) {
+        render_settings& s = out.settings;
+        if (!height_given)
+            s.image_height = static_cast<int>(s.image_width / s.aspect_ratio);
+        else if (!aspect_given)
+            s.aspect_ratio = static_cast<double>(s.image_width) / s.image_height;
+        if (s.image_width <= 0 || s.image_height <= 0 || s.samples_per_pixel <= 0 || s.pass_samples <= 0
+            || s.tile_size <= 0 || s.max_depth <= 0) {
+            error = "image size, spp, pass_spp, tile and max_depth must be positive";
+            return false;
+        }
+        for (auto& b : bakes) {
+            if (!b.covered) {
+                std::cerr << "Texture " << b.name << " is not on any shape; not baked\n";
+                continue;
+            }
+            const noise_bake_report r = b.texture->bake(b.box, b.resolution);
+            std::cerr << "Texture " << b.name << " baked: " << r.resolution << "^3 grid, " << (r.bytes >> 20)
+                      << " MiB, " << r.seconds << " s; against procedural noise: RMS error " << r.rms_error
+                      << ", max error " << r.max_error << ", lookups " << r.speedup << "x faster\n";
+        }
+        return true;
+    }
+
+private:
+    scene& out;
+    std::string directory;
+    std::unordered_map<std::string, std::shared_ptr<texture>> textures;
+    std::unordered_map<std::string, const material*> materials;
+    std::unordered_map<std::string, std::shared_ptr<hittable>> shapes;
+    // BVHs over the defined groups (OBJ triangle lists), shared by their
+    // instances; "add" still takes the group's triangles one by one.
+    std::unordered_map<const hittable*, std::shared_ptr<hittable>> blases;
+    std::unordered_map<const material*, const texture*> material_textures;
+    std::unordered_map<const hittable*, const material*> shape_materials;
+    const material* shape_material = nullptr;   // of the shape being parsed
+
+    struct noise_bake {
+        std::string name;
+        std::shared_ptr<noise_texture> texture;
+        int resolution;
+        aabb box;       // world bounds of the shapes using the texture
+        bool covered;
+    };
+    std::vector<noise_bake> bakes;
+
+    bool height_given = false;
+    bool aspect_given = false;
+
+    std::string resolve(const std::string& file) const {
+        return file.empty() || file[0] == '/' ? file : directory + file;
+    }
+
+    void parse_render(statement& st) {
+        render_settings& s = out.settings;
+        while (!st.at_end() && st.ok()) {
+            const std::string key = st.word("a setting");
+            if (key == "width") s.image_width = st.integer("width");
+            else if (key == "height") { s.image_height = st.integer("height"); height_given = true; }
+            else if (key == "aspect") { s.aspect_ratio = parse_ratio(st); aspect_given = true; }
+            else if (key == "spp") s.samples_per_pixel = st.integer("spp");
+            else if (key == "max_depth") s.max_depth = st.integer("max_depth");
+            else if (key == "rr_min_depth") s.rr_min_depth = st.integer("rr_min_depth");
+            else if (key == "seed") s.seed = static_cast<uint64_t>(st.integer("seed"));
+            else if (key == "tile") s.tile_size = st.integer("tile");
+            else if (key == "pass_spp") s.pass_samples = st.integer("pass_spp");
+            else if (key == "noise_target") s.noise_target = st.number("noise_target");
+            else if (key == "sampler") s.pixel_sampler = parse_sampler(st);
+            else if (key == "denoise") s.denoise = parse_switch(st);
+            else st.fail("unknown render setting '" + key + "'");
+        }
+    }
+
+    static double parse_ratio(statement& st) {
+        const std::string token = st.word("an aspect ratio");
+        const size_t slash = token.find('/');
+        const double numerator = std::atof(token.substr(0, slash).c_str());
+        const double denominator = slash == std::string::npos ? 1.0 : std::atof(token.substr(slash + 1).c_str());
+        if (!(numerator > 0 && denominator > 0))
+            st.fail("bad aspect ratio '" + token + "'");
+        return denominator > 0 ? numerator / denominator : 1.0;
+    }
+
+    static sampler_type parse_sampler(statement& st) {
+        const std::string name = st.word("a sampler");
+        if (name == "independent") return sampler_type::independent;
+        if (name == "stratified") return sampler_type::stratified;
+        if (name == "blue_noise") return sampler_type::blue_noise;
+        if (name != "sobol")
+            st.fail("unknown sampler '" + name + "'");
+        return sampler_type::sobol;
+    }
+
+    static bool parse_switch(statement& st) {
+        const std::string value = st.word("on or off");
+        if (value != "on" && value != "off")
+            st.fail("expected on or off, got '" + value + "'");
+        return value == "on";
+    }
+
+    void parse_camera(statement& st) {
+        camera_settings& v = out.view;
+        while (!st.at_end() && st.ok()) {
+            const std::string key = st.word("a camera setting");
+            if (key == "from") v.lookfrom = st.triple("camera position");
+            else if (key == "to") v.lookat = st.triple("camera target");
+            else if (key == "up") v.vup = st.triple("up vector");
+            else if (key == "fov") v.vfov = st.number("field of view");
+            else if (key == "aperture") v.aperture = st.number("aperture");
+            else if (key == "focus") v.focus_dist = st.number("focus distance");
+            else st.fail("unknown camera setting '" + key + "'");
+        }
+    }
+
+    void parse_output(statement& st) {
+        if (st.at_end())
+            st.fail("expected an output file");
+        while (!st.at_end())
+            out.outputs.push_back(st.word("an output file"));
+    }
+
+    color parse_color(statement& st) {
+        return st.triple("a color");
+    }
+
+    void parse_texture(statement& st) {
+        const std::string name = st.word("a texture name");
+        const std::string kind = st.word("a texture type");
+        std::shared_ptr<texture> tex;
+        if (kind == "solid") {
+            tex = std::make_shared<solid_color>(parse_color(st));
+        } else if (kind == "checker") {
+            const color even = parse_color(st);
+            tex = std::make_shared<checker_texture>(even, parse_color(st));
+        } else if (kind == "image") {
+            tex = std::make_shared<image_texture>(resolve(st.word("an image file")).c_str());
+        } else if (kind == "noise") {
+            auto noise = std::make_shared<noise_texture>(st.number("a noise scale"));
+            if (st.peek("bake")) {
+                st.word("bake");
+                const int resolution = st.integer("a bake resolution");
+                if (resolution < 4 || resolution > 1024)
+                    st.fail("bake resolution must be between 4 and 1024");
+                bakes.push_back({name, noise, resolution, aabb(), false});
+            }
+            tex = noise;
+        } else {
+            st.fail("unknown texture type '" + kind + "'");
+        }
+        textures[name] = tex;
+    }
+
+    void parse_material(statement& st) {
+        const std::string name = st.word("a material name");
+        const std::string kind = st.word("a material type");
+        std::shared_ptr<material> m;
+        if (kind == "lambertian") {
+            if (st.peek("texture")) {
+                st.word("texture");
+                auto tex = find_texture(st);
+                m = std::make_shared<lambertian>(tex);
+                material_textures[m.get()] = tex.get();
+            } else {
+                m = std::make_shared<lambertian>(parse_color(st));
+            }
+        } else if (kind == "metal") {
+            const color albedo = parse_color(st);
+            double fuzz = 0.0;
+            if (st.peek("fuzz")) {
+                st.word("fuzz");
+                fuzz = st.number("fuzz");
+            }
+            m = std::make_shared<metal>(albedo, fuzz);
+        } else if (kind == "dielectric") {
+            m = std::make_shared<dielectric>(st.number("an index of refraction"));
+        } else if (kind == "emissive") {
+            const color emit = parse_color(st);
+            const bool one_sided = st.peek("one_sided");
+            if (one_sided)
+                st.word("one_sided");
+            m = std::make_shared<emissive>(emit, !one_sided);
+        } else if (kind == "isotropic") {
+            m = std::make_shared<isotropic>(parse_color(st));
+        } else {
+            st.fail("unknown material type '" + kind + "'");
+        }
+        if (m)
+            materials[name] = out.materials.add(m);
+    }
+
+    std::shared_ptr<texture> find_texture(statement& st) {
+        const std::string name = st.word("a texture name");
+        auto found = textures.find(name);
+        if (found == textures.end()) {
+            st.fail("unknown texture '" + name + "'");
+            return std::make_shared<solid_color>(color(0, 0, 0));
+        }
+        return found->second;
+    }
+
+    const material* find_material(statement& st) {
+        const std::string name = st.word("a material name");
+        if (name == "none")
+            return nullptr;
+        auto found = materials.find(name);
+        if (found == materials.end()) {
+            st.fail("unknown material '" + name + "'");
+            return nullptr;
+        }
+        shape_material = found->second;
+        return found->second;
+    }
+
+    std::shared_ptr<hittable> named_shape(statement& st) {
+        const std::string name = st.word("a shape name");
+        auto found = shapes.find(name);
+        if (found == shapes.end()) {
+            st.fail("unknown shape '" + name + "'");
+            return nullptr;
+        }
+        return found->second;
+    }
+
+    // Remembers each shape's material, so baked textures can find the
+    // shapes they cover.
+    std::shared_ptr<hittable> parse_shape(const std::string& kind, statement& st) {
+        shape_material = nullptr;
+        auto shape = make_shape(kind, st);
+        if (shape && shape_material)
+            shape_materials[shape.get()] = shape_material;
+        return shape;
+    }
+
+    std::shared_ptr<hittable> make_shape(const std::string& kind, statement& st) {
+        if (kind == "sphere") {
+            const material* m = find_material(st);
+            const point3 center = st.triple("a center");
+            return std::make_shared<sphere>(center, st.number("a radius"), m);
+        }
+        if (kind == "moving_sphere") {
+            const material* m = find_material(st);
+            const point3 center0 = st.triple("a start center");
+            const point3 center1 = st.triple("an end center");
+            const double time0 = st.number("a start time");
+            const double time1 = st.number("an end time");
+            return std::make_shared<moving_sphere>(center0, center1, time0, time1, st.number("a radius"), m);
+        }
+        if (kind == "quad") {
+            const material* m = find_material(st);
+            const point3 lo = st.triple("a min corner");
+            const point3 hi = st.triple("a max corner");
+            const std::string axis = st.word("an axis");
+            if (axis != "x" && axis != "y" && axis != "z")
+                st.fail("expected axis x, y or z, got '" + axis + "'");
+            return std::make_shared<quad>(lo, hi, m, axis[0] - 'x');
+        }
+        if (kind == "triangle") {
+            const material* m = find_material(st);
+            const point3 a = st.triple("a vertex");
+            const point3 b = st.triple("a vertex");
+            return std::make_shared<triangle>(a, b, st.triple("a vertex"), m);
+        }
+        if (kind == "mesh") {
+            const material* m = find_material(st);
+            const std::string file = resolve(st.word("an OBJ file"));
+            if (!st.ok())
+                return nullptr;
+            bool from_cache = false;
+            auto mesh = load_obj_as_cached_mesh(file, m, from_cache);
+            if (!mesh) {
+                st.fail("could not load mesh " + file);
+                return nullptr;
+            }
+            std::cerr << "Mesh " << file << (from_cache ? " (cached)" : "") << ": " << mesh->triangle_count()
+                      << " triangles, " << mesh->vertex_count() << " shared vertices, " << mesh->memory_bytes()
+                      << " bytes\n";
+            return mesh;
+        }
+        if (kind == "obj") {
+            const material* m = find_material(st);
+            const std::string file = resolve(st.word("an OBJ file"));
+            if (!st.ok())
+                return nullptr;
+            auto triangles = std::make_shared<hittable_list>();
+            if (load_obj_as_triangles(file, *triangles, m) == 0) {
+                st.fail("could not load triangles from " + file);
+                return nullptr;
+            }
+            std::cerr << "OBJ " << file << ": " << triangles->objects.size() << " triangles\n";
+            return triangles;
+        }
+        if (kind == "medium") {
+            auto boundary = named_shape(st);
+            const double density = st.number("a density");
+            const color albedo = parse_color(st);
+            if (!boundary || density <= 0) {
+                st.fail("a medium needs a named boundary shape and a positive density");
+                return nullptr;
+            }
+            return std::make_shared<constant_medium>(boundary, density, albedo);
+        }
+        if (kind == "volume") {
+            const std::string format = st.word("dense or bricks");
+            const std::string file = resolve(st.word("a voxel file"));
+            int size[3] = { 0, 0, 0 };
+            if (format == "dense") {
+                for (auto& n : size)
+                    n = st.integer("a grid size");
+            } else if (format != "bricks") {
+                st.fail("expected dense or bricks, got '" + format + "'");
+            }
+            const point3 lo = st.triple("a min corner");
+            const point3 hi = st.triple("a max corner");
+            const double density = st.number("a density");
+            const color albedo = parse_color(st);
+            if (!st.ok())
+                return nullptr;
+            if (!(lo.x() < hi.x() && lo.y() < hi.y() && lo.z() < hi.z()) || density <= 0) {
+                st.fail("a volume needs a box with min below max and a positive density");
+                return nullptr;
+            }
+            auto grid = std::make_shared<voxel_grid>();
+            if (format == "dense" ? !grid->load_dense(file, size[0], size[1], size[2]) : !grid->load_bricks(file)) {
+                st.fail("could not load voxel grid " + file);
+                return nullptr;
+            }
+            std::cerr << "Volume " << file << ": " << grid->size(0) << " x " << grid->size(1) << " x " << grid->size(2)
+                      << " voxels, " << grid->stored_bricks() << " of "
+                      << static_cast<size_t>(grid->bricks(0)) * grid->bricks(1) * grid->bricks(2)
+                      << " bricks stored, " << grid->memory_bytes() << " bytes\n";
+            return std::make_shared<grid_medium>(grid, aabb(lo, hi), density, albedo);
+        }
+        st.fail("unknown statement '" + kind + "'");
+        return nullptr;
+    }
+
+    void parse_define(statement& st) {
+        const std::string name = st.word("a shape name");
+        auto shape = parse_shape(st.word("a shape type"), st);
+        if (!shape)
+            return;
+        shapes[name] = shape;
+        if (auto list = std::dynamic_pointer_cast<hittable_list>(shape)) {
+            auto blas = make_blas(*list);
+            auto m = shape_materials.find(shape.get());
+            if (m != shape_materials.end())
+                shape_materials[blas.get()] = m->second;
+            blases[shape.get()] = blas;
+        }
+    }
+
+    void parse_instance(statement& st) {
+        auto shape = named_shape(st);
+        affine_transform to_world;
+        while (!st.at_end() && st.ok()) {
+            const std::string op = st.word("a transform");
+            if (op == "translate") {
+                to_world = affine_transform::translation(st.triple("an offset")) * to_world;
+            } else if (op == "rotate") {
+                const vec3 axis = st.triple("a rotation axis");
+                to_world = affine_transform::rotation(axis, st.number("an angle")) * to_world;
+            } else if (op == "scale") {
+                to_world = affine_transform::scaling(st.triple("a scale")) * to_world;
+            } else {
+                st.fail("unknown transform '" + op + "'");
+            }
+        }
+        if (shape && st.ok()) {
+            auto blas = blases.find(shape.get());
+            if (blas != blases.end())
+                shape = blas->second;
+            auto placed = std::make_shared<instance>(shape, to_world);
+            cover(*shape, *placed);
+            out.accel.add(placed);
+        }
+    }
+
+    // Grows the box of every baked texture on shape's material by the world
+    // bounds of placed, a placement of shape.
+    void cover(const hittable& shape, const hittable& placed) {
+        auto m = shape_materials.find(&shape);
+        if (m == shape_materials.end())
+            return;
+        auto t = material_textures.find(m->second);
+        aabb box;
+        if (t == material_textures.end() || !placed.bounding_box(box))
+            return;
+        for (auto& b : bakes) {
+            if (b.texture.get() != t->second)
+                continue;
+            b.box = b.covered ? surrounding_box(b.box, box) : box;
+            b.covered = true;
+        }
+    }
+
+    // OBJ triangles go in one by one so that the top-level BVH and the
+    // light list see each of them.
+    void add(const std::shared_ptr<hittable>& shape) {
+        if (!shape)
+            return;
+        cover(*shape, *shape);
+        if (auto list = std::dynamic_pointer_cast<hittable_list>(shape)) {
+            for (const auto& object : list->objects)
+                out.accel.add(object);
+        } else {
+            out.accel.add(shape);
+        }
+    }
+};
+
+std::vector<std::string> split_words(const std::string& line) {
+    std::vector<std::string> words;
+    std::istringstream in(line.substr(0, line.find('#')));
+    std::string word;
+    while (in >> word)
+        words.push_back(word);
+    return words;
+}
+
+void fnv1a(uint64_t& hash, const std::string& text) {
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+}
+
+} // namespace
+
+bool load_scene(const std::string& path, scene& out) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Could not open scene " << path << "\n";
+        return false;
+    }
+    const std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    out.content_hash = 0xcbf29ce484222325ull;
+
+    scene_builder builder(out, path);
+    std::istringstream lines(text);
+    std::string line;
+    for (int number = 1; std::getline(lines, line); ++number) {
+        std::vector<std::string> words = split_words(line);
+        if (words.empty())
+            continue;
+        if (words[0] != "render" && words[0] != "output") {
+            for (const auto& word : words)
+                fnv1a(out.content_hash, word + " ");
+            fnv1a(out.content_hash, "\n");
+        }
+        statement st(std::move(words), number);
+        builder.parse(st);
+        if (!st.ok()) {
+            std::cerr << path << ":" << st.line << ": " << st.error << "\n";
+            return false;
+        }
+    }
+
+    std::string error;
+    if (!builder.finish(error)) {
+        std::cerr << path << ": " << error << "\n";
+        return false;
+    }
+    if (out.outputs.empty())
+        out.outputs = {"output.ppm", "output.hdr"};
+
+    out.accel.rebuild();
+    out.lights = light_list(out.accel.objects);
+    return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "camera.h"
+#include "instance.h"
+#include "light_list.h"
+#include "material.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scene files are plain text, one statement per line; '#' starts a comment.
+// Input file names are relative to the scene file, output file names to the
+// working directory. Colors and points are three numbers. Keyword arguments
+// in [brackets] are optional.
+//
+//   render [width N] [height N] [aspect W/H] [spp N] [max_depth N]
+//          [rr_min_depth N] [seed N] [tile N] [pass_spp N] [noise_target E]
+//          [sampler independent|stratified|sobol|blue_noise] [denoise on|off]
+//   camera from P to P [up V] [fov DEGREES] [aperture A] [focus DISTANCE]
+//   output FILE...                      images to write (.ppm, .pfm, .hdr)
+//
+//   texture NAME solid C | checker C C | image FILE | noise SCALE [bake N]
+//                                       bake: precompute the noise on an N^3
+//                                       grid over the shapes that use it
+//   material NAME lambertian C | lambertian texture TEX
+//   material NAME metal C [fuzz F]
+//   material NAME dielectric IOR
+//   material NAME emissive C [one_sided]
+//   material NAME isotropic C
+//
+// Shapes take a material name ("none" for shapes that only bound a medium):
+//   sphere MAT CENTER RADIUS
+//   moving_sphere MAT CENTER0 CENTER1 TIME0 TIME1 RADIUS
+//   quad MAT MIN MAX x|y|z
+//   triangle MAT P0 P1 P2
+//   mesh MAT FILE                       OBJ as one indexed triangle mesh, cached
+//                                       in FILE.meshcache (see mesh_cache.h)
+//   obj MAT FILE                        OBJ as separate triangles
+//   medium BOUNDARY DENSITY C           constant density inside a named shape
+//   volume dense FILE NX NY NZ MIN MAX DENSITY C
+//   volume bricks FILE MIN MAX DENSITY C
+//                                       voxel densities (see grid_medium.h)
+//                                       times DENSITY, over the box MIN-MAX
+//
+// A shape statement adds the shape to the scene. "define NAME <shape>" only
+// names it, "add NAME" adds a named shape, and
+//   instance NAME [translate V] [rotate AXIS DEGREES] [scale V]...
+// adds a transformed copy, applying the transforms in the order written. A
+// defined obj gets one BVH, built at its define and shared by its instances.
+//
+// Everything not given keeps the defaults below.
+
+struct render_settings {
+    int image_width = 1200;
+    int image_height = 675;
+    double aspect_ratio = 16.0 / 9.0;   // of the camera; the height follows from it unless given
+    int samples_per_pixel = 500;
+    int max_depth = 50;
+    int rr_min_depth = 3;
+    int tile_size = 16;
+    int pass_samples = 16;
+    uint64_t seed = 0;
+    sampler_type pixel_sampler = sampler_type::sobol;
+    double noise_target = 0.001;
+    bool denoise = true;
+};
+
+struct camera_settings {
+    point3 lookfrom = point3(0, 0, 1);
+    point3 lookat = point3(0, 0, 0);
+    vec3 vup = vec3(0, 1, 0);
+    double vfov = 40.0;
+    double aperture = 0.0;
+    double focus_dist = 0.0;   // 0: the distance from lookfrom to lookat
+};
+
+// A loaded scene. Shapes are added straight to the top-level acceleration
+// structure, which is built once the whole file has been read.
+struct scene {
+    render_settings settings;
+    camera_settings view;
+    std::vector<std::string> outputs;
+    material_table materials;
+    tlas accel;
+    light_list lights;
+    // Hash of every statement but render and output (comments and spacing
+    // ignored), so checkpoints survive e.g. a new noise_target; the render
+    // settings that matter are keyed separately.
+    uint64_t content_hash = 0;
+
+    camera make_camera() const {
+        const double focus = view.focus_dist > 0 ? view.focus_dist : (view.lookfrom - view.lookat).length();
+        camera cam(view.lookfrom, view.lookat, view.vup, view.vfov, settings.aspect_ratio, view.aperture, focus);
+        // Many samples per pixel already average over the pixel, so texture
+        // footprints shrink with their square root (but at most eightfold).
+        const double footprint = std::max(0.125, 1.0 / std::sqrt(static_cast<double>(settings.samples_per_pixel)));
+        cam.set_pixel_spacing(footprint / std::max(1, settings.image_width - 1),
+                              footprint / std::max(1, settings.image_height - 1));
+        return cam;
+    }
+};
+
+// Reads path into out, building the acceleration structure and light list.
+// Returns false after reporting the file and line of the first error on
+// std::cerr.
+bool load_scene(const std::string& path, scene& out);
@@ -2,40 +2,36 @@
 #include "hittable.h"
 #include <memory>
 #include "material.h"
+#include "rtweekend.h"
 
 class sphere : public hittable {
 public:
     point3 center;
     double radius;
-    std::shared_ptr<material> mat_ptr;
+    const material* mat_ptr;
 
     sphere() {}
-    sphere(point3 c, double r, std::shared_ptr<material> m) : center(c), radius(r), mat_ptr(m) {}
+    sphere(point3 c, double r, const material* m) : center(c), radius(r), mat_ptr(m) {}
 
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
-        vec3 oc = r.origin() - center;
-        auto a = r.direction().length_squared();
-        auto half_b = dot(oc, r.direction());
-        auto c = oc.length_squared() - radius*radius;
-        auto discriminant = half_b*half_b - a*c;
-        if (discriminant < 0) return false;
-        auto sqrtd = std::sqrt(discriminant);
-
-        auto root = (-half_b - sqrtd) / a;
-        if (root < t_min || root > t_max) {
-            root = (-half_b + sqrtd) / a;
-            if (root < t_min || root > t_max)
-                return false;
-        }
+        double root;
+        if (!nearest_root(r, t_min, t_max, root))
+            return false;
 
         rec.t = root;
         rec.p = r.at(rec.t);
-        get_sphere_uv(rec.normal, rec.u, rec.v);
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
+        set_surface(outward_normal, radius, rec);
         rec.mat_ptr = mat_ptr;
+        rec.object = this;
         return true;
     }
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        double root;
+        return nearest_root(r, t_min, t_max, root);
+    }
+
     virtual bool bounding_box(aabb& output_box) const override {
         output_box = aabb(
             center - vec3(radius, radius, radius),
@@ -43,13 +39,68 @@ public:
         );
         return true;
     }    
+
+    // Samples the cone of directions the sphere subtends from origin.
+    virtual double pdf_value(const point3& origin, const vec3& direction) const override {
+        double dist_sq = (center - origin).length_squared();
+        if (dist_sq <= radius * radius || !occluded(ray(origin, direction), 0.001, infinity))
+            return 0.0;
+        double cos_theta_max = std::sqrt(1.0 - radius * radius / dist_sq);
+        return 1.0 / (2.0 * pi * (1.0 - cos_theta_max));
+    }
+
+    virtual vec3 random(const point3& origin, const vec2& u) const override {
+        vec3 w = center - origin;
+        double dist_sq = w.length_squared();
+        w = unit_vector(w);
+        if (dist_sq <= radius * radius)
+            return w;
+        double cos_theta_max = std::sqrt(1.0 - radius * radius / dist_sq);
+        double z = 1.0 + u.y() * (cos_theta_max - 1.0);
+        double sin_theta = std::sqrt(std::fmax(0.0, 1.0 - z * z));
+        double phi = 2.0 * pi * u.x();
+        vec3 a, b;
+        onb_from_w(w, a, b);
+        return std::cos(phi) * sin_theta * a + std::sin(phi) * sin_theta * b + z * w;
+    }
+
+    virtual const material* surface_material() const override { return mat_ptr; }
+    virtual double area() const override { return 4.0 * pi * radius * radius; }
+
     private:
-    static void get_sphere_uv(const point3& p, double& u, double& v) {
-        auto theta = acos(-p.y());
-        auto phi = atan2(-p.z(), p.x()) + pi;
+    bool nearest_root(const ray& r, double t_min, double t_max, double& root) const {
+        vec3 oc = r.origin() - center;
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius*radius;
+        auto discriminant = half_b*half_b - a*c;
+        if (discriminant < 0) return false;
+        auto sqrtd = std::sqrt(discriminant);
+
+        root = (-half_b - sqrtd) / a;
+        if (root < t_min || root > t_max) {
+            root = (-half_b + sqrtd) / a;
+            if (root < t_min || root > t_max)
+                return false;
+        }
+        return true;
+    }
+
+public:
+    // Texture coordinates of the unit outward normal n, with the partial
+    // derivatives of the surface in them.
+    static void set_surface(const vec3& n, double radius, hit_record& rec) {
+        auto theta = acos(-n.y());
+        auto phi = atan2(-n.z(), n.x()) + pi;
+
+        rec.u = phi / (2*pi);
+        rec.v = theta / pi;
 
-        u = phi / (2*pi);
-        v = theta / pi;
+        // Clamped so the poles keep a usable parameterization.
+        double sin_theta = std::fmax(std::sqrt(n.x() * n.x() + n.z() * n.z()), 1e-6);
+        vec3 dndu = 2 * pi * vec3(n.z(), 0, -n.x());
+        vec3 dndv = pi * vec3(-n.x() * n.y() / sin_theta, sin_theta, -n.y() * n.z() / sin_theta);
+        rec.set_partials(radius * dndu, radius * dndv, dndu, dndv);
     }
 
 };
\ No newline at end of file
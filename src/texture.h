@@ -1,5 +1,6 @@
 #pragma once
 #include "vec3.h"
+#include "hittable.h"
 #include "rtweekend.h"
 
 class texture {
@@ -7,4 +8,11 @@ public:
     virtual ~texture() = default;
 
     virtual color value(double u, double v, const point3& p) const = 0;
-};
\ No newline at end of file
+
+    // The texture averaged over the pixel footprint at rec (see
+    // hit_record::compute_differentials). Textures without a filtered
+    // lookup return the point value.
+    virtual color filtered_value(const hit_record& rec) const {
+        return value(rec.u, rec.v, rec.p);
+    }
+};
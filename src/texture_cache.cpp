@@ -0,0 +1,180 @@
+#include "texture_cache.h"
+
+namespace {
+
+// Lookup counts, one block per thread on its own cache line so that
+// counting does not bounce a shared line between threads. Blocks outlive
+// their threads so that the totals stay complete.
+struct alignas(64) thread_counters {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+};
+
+std::mutex counters_lock;
+std::vector<std::unique_ptr<thread_counters>> all_counters;
+
+thread_counters& local_counters() {
+    thread_local thread_counters* counters = [] {
+        std::lock_guard<std::mutex> guard(counters_lock);
+        all_counters.push_back(std::make_unique<thread_counters>());
+        return all_counters.back().get();
+    }();
+    return *counters;
+}
+
+void count(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// The last few tiles this thread used, direct mapped by key. Tiles never
+// change once loaded and keys are never reused, so entries cannot go stale.
+const int memo_size = 8;
+
+struct memo_entry {
+    uint64_t key = ~0ull;
+    texture_cache::tile_ptr tile;
+};
+
+memo_entry& memo_slot(uint64_t key) {
+    thread_local memo_entry memo[memo_size];
+    return memo[(key ^ (key >> 16) ^ (key >> 40)) % memo_size];
+}
+
+} // namespace
+
+texture_cache::texture_cache() : byte_budget(size_t(256) << 20) {}
+
+texture_cache& texture_cache::global() {
+    static texture_cache cache;
+    return cache;
+}
+
+void texture_cache::set_budget(size_t bytes) {
+    byte_budget = bytes;
+}
+
+size_t texture_cache::budget() const {
+    return byte_budget;
+}
+
+uint32_t texture_cache::register_texture() {
+    return next_texture_id++;
+}
+
+texture_cache::tile_ptr texture_cache::get(uint64_t key, const tile_loader& loader) {
+    memo_entry& slot = memo_slot(key);
+    if (slot.key == key) {
+        count(local_counters().hits);
+        return slot.tile;
+    }
+    tile_ptr tile = find_or_load(key, loader);
+    if (tile) {
+        slot.key = key;
+        slot.tile = tile;
+    }
+    return tile;
+}
+
+texture_cache::tile_ptr texture_cache::find_or_load(uint64_t key, const tile_loader& loader) {
+    shard& s = shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        auto found = s.index.find(key);
+        if (found != s.index.end()) {
+            s.lru.splice(s.lru.begin(), s.lru, found->second);
+            count(local_counters().hits);
+            return found->second->tile;
+        }
+    }
+
+    // Read without holding the shard, so other threads' hits are not held
+    // up by file I/O. Two threads missing on the same tile both read it and
+    // the second keeps the first one's copy.
+    count(local_counters().misses);
+    auto texels = std::make_shared<texture_tile>();
+    if (!loader.load_tile(key, *texels))
+        return nullptr;
+    const size_t bytes = texels->size();
+
+    if (!reserve(bytes))
+        return texels;
+
+    std::lock_guard<std::mutex> guard(s.lock);
+    auto found = s.index.find(key);
+    if (found != s.index.end()) {
+        total_bytes -= bytes;
+        return found->second->tile;
+    }
+    s.lru.push_front({key, texels});
+    s.index[key] = s.lru.begin();
+    return texels;
+}
+
+// Claims bytes of the budget for a new tile, evicting as needed. If even
+// the emptied cache has no room (the budget is below one tile, or other
+// threads hold the rest as reservations), the tile is handed out uncached.
+bool texture_cache::reserve(size_t bytes) {
+    size_t total = total_bytes.load();
+    for (;;) {
+        if (total + bytes <= byte_budget) {
+            if (total_bytes.compare_exchange_weak(total, total + bytes))
+                break;
+        } else if (evict_one()) {
+            total = total_bytes.load();
+        } else {
+            return false;
+        }
+    }
+    size_t peak = peak_bytes.load();
+    while (total + bytes > peak && !peak_bytes.compare_exchange_weak(peak, total + bytes)) {}
+    return true;
+}
+
+// Drops the least recently used tile of the next nonempty shard, taking
+// the shards in turn so the budget is shared by all of them. False if
+// every shard is empty.
+bool texture_cache::evict_one() {
+    const unsigned first = next_victim++;
+    for (int i = 0; i < shard_count; ++i) {
+        shard& s = shards[(first + i) % shard_count];
+        std::lock_guard<std::mutex> guard(s.lock);
+        if (s.lru.empty())
+            continue;
+        const entry& oldest = s.lru.back();
+        const size_t bytes = oldest.tile->size();
+        s.index.erase(oldest.key);
+        s.lru.pop_back();
+        total_bytes -= bytes;
+        s.evictions++;
+        return true;
+    }
+    return false;
+}
+
+texture_cache_stats texture_cache::statistics() const {
+    texture_cache_stats stats;
+    {
+        std::lock_guard<std::mutex> guard(counters_lock);
+        for (const auto& c : all_counters) {
+            stats.hits += c->hits.load(std::memory_order_relaxed);
+            stats.misses += c->misses.load(std::memory_order_relaxed);
+        }
+    }
+    for (const auto& s : shards) {
+        std::lock_guard<std::mutex> guard(s.lock);
+        stats.evictions += s.evictions;
+    }
+    stats.bytes = total_bytes;
+    stats.peak_bytes = peak_bytes;
+    stats.budget = byte_budget;
+    return stats;
+}
+
+void texture_cache::report(std::ostream& out) const {
+    const texture_cache_stats stats = statistics();
+    const uint64_t lookups = stats.hits + stats.misses;
+    out << "Texture cache: " << lookups << " tile lookups, "
+        << (lookups ? 100.0 * stats.hits / lookups : 0.0) << "% hits, " << stats.misses << " tiles read, "
+        << stats.evictions << " evicted, peak " << (stats.peak_bytes >> 10) << " of "
+        << (stats.budget >> 10) << " KiB\n";
+}
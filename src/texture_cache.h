@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// Texels of one square tile of one mip level, 8-bit RGB, row by row.
+using texture_tile = std::vector<unsigned char>;
+
+// Fills tiles on a cache miss. Keys are built with texture_cache::tile_key.
+class tile_loader {
+public:
+    virtual ~tile_loader() = default;
+    virtual bool load_tile(uint64_t key, texture_tile& texels) const = 0;
+};
+
+struct texture_cache_stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;      // tiles read from their source
+    uint64_t evictions = 0;
+    size_t bytes = 0;         // tiles held now
+    size_t peak_bytes = 0;
+    size_t budget = 0;
+};
+
+// Process-wide cache of texture tiles with a byte budget, shared by every
+// image_texture. The cache is split into independently locked shards that
+// share one budget; when it is full, the shards in turn give up their least
+// recently used tile. Each thread also keeps its last few tiles (8), so most
+// lookups take no lock at all. Tiles handed out stay valid after eviction
+// because they are reference counted, so these per-thread tiles can outlive
+// their eviction and add up to 8 tiles per thread over the budget.
+class texture_cache {
+public:
+    using tile_ptr = std::shared_ptr<const texture_tile>;
+
+    static texture_cache& global();
+
+    // Takes effect on the next insertion.
+    void set_budget(size_t bytes);
+    size_t budget() const;
+
+    // A new id for a texture's tiles; ids are never reused.
+    uint32_t register_texture();
+
+    static uint64_t tile_key(uint32_t texture_id, int level, int tile_x, int tile_y) {
+        return (static_cast<uint64_t>(texture_id) << 40) | (static_cast<uint64_t>(level) << 32)
+             | (static_cast<uint64_t>(tile_y) << 16) | static_cast<uint64_t>(tile_x);
+    }
+
+    // nullptr if the tile is not cached and loader cannot produce it.
+    tile_ptr get(uint64_t key, const tile_loader& loader);
+
+    texture_cache_stats statistics() const;
+    void report(std::ostream& out) const;
+
+private:
+    static const int shard_count = 16;
+
+    struct entry {
+        uint64_t key;
+        tile_ptr tile;
+    };
+
+    struct shard {
+        mutable std::mutex lock;
+        std::list<entry> lru;   // most recently used first
+        std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+        uint64_t evictions = 0;
+    };
+
+    texture_cache();
+
+    shard shards[shard_count];
+    std::atomic<size_t> byte_budget;
+    std::atomic<size_t> total_bytes{0};
+    std::atomic<size_t> peak_bytes{0};
+    std::atomic<uint32_t> next_texture_id{0};
+    std::atomic<unsigned> next_victim{0};   // shard to evict from next
+
+    tile_ptr find_or_load(uint64_t key, const tile_loader& loader);
+    bool reserve(size_t bytes);
+    bool evict_one();
+};
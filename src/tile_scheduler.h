@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+struct tile {
+    int x0, y0;
+    int x1, y1;  // exclusive
+};
+
+enum class tile_order { scanline, morton, hilbert };
+
+inline uint32_t morton_code(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// Distance of (x, y) along a Hilbert curve covering an n x n grid, n a power of two.
+inline uint32_t hilbert_index(uint32_t n, uint32_t x, uint32_t y) {
+    uint32_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+// Splits the image into tiles, deals them out to per-thread deques in curve
+// order and lets idle threads steal from the back of other threads' deques.
+class tile_scheduler {
+public:
+    struct thread_stats {
+        double busy_seconds = 0;
+        double idle_seconds = 0;
+        int tiles = 0;
+        int stolen = 0;
+    };
+
+    tile_scheduler(int width, int height, int tile_size, tile_order order, int num_threads)
+        : thread_count(std::max(1, num_threads)), stats(thread_count) {
+        tile_size = std::max(1, tile_size);
+        int tiles_x = (width + tile_size - 1) / tile_size;
+        int tiles_y = (height + tile_size - 1) / tile_size;
+
+        uint32_t n = 1;
+        while (n < static_cast<uint32_t>(std::max(tiles_x, tiles_y))) n *= 2;
+
+        std::vector<std::pair<uint32_t, tile>> keyed;
+        for (int ty = 0; ty < tiles_y; ++ty) {
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                tile t = { tx * tile_size, ty * tile_size,
+                           std::min(width, (tx + 1) * tile_size), std::min(height, (ty + 1) * tile_size) };
+                uint32_t key = order == tile_order::morton ? morton_code(tx, ty)
+                             : order == tile_order::hilbert ? hilbert_index(n, tx, ty)
+                             : static_cast<uint32_t>(ty * tiles_x + tx);
+                keyed.push_back({key, t});
+            }
+        }
+        std::sort(keyed.begin(), keyed.end(),
+                  [](const std::pair<uint32_t, tile>& a, const std::pair<uint32_t, tile>& b) {
+                      return a.first < b.first;
+                  });
+        for (const auto& k : keyed)
+            tiles.push_back(k.second);
+
+        for (int t = 0; t < thread_count; ++t)
+            queues.push_back(std::make_unique<worker_queue>());
+    }
+
+    size_t tile_count() const { return tiles.size(); }
+
+    // Calls render_tile(tile, thread_id) once for every tile. May be called
+    // again (e.g. once per progressive pass); statistics add up over runs.
+    template <typename Fn>
+    void run(Fn&& render_tile) {
+        using clock = std::chrono::steady_clock;
+        const auto run_start = clock::now();
+
+        // Contiguous runs along the curve keep each thread's tiles close together.
+        for (int t = 0; t < thread_count; ++t)
+            queues[t]->items.clear();
+        for (size_t i = 0; i < tiles.size(); ++i)
+            queues[i * thread_count / tiles.size()]->items.push_back(static_cast<int>(i));
+
+        #pragma omp parallel num_threads(thread_count)
+        {
+#ifdef _OPENMP
+            const int id = omp_get_thread_num();
+#else
+            const int id = 0;
+#endif
+            if (id < thread_count) {
+                int index;
+                bool stolen;
+                while (next_tile(id, index, stolen)) {
+                    auto start = clock::now();
+                    render_tile(tiles[index], id);
+                    stats[id].busy_seconds += std::chrono::duration<double>(clock::now() - start).count();
+                    stats[id].tiles++;
+                    if (stolen) stats[id].stolen++;
+                }
+            }
+        }
+
+        const auto run_end = clock::now();
+        wall_seconds += std::chrono::duration<double>(run_end - run_start).count();
+        for (int t = 0; t < thread_count; ++t)
+            stats[t].idle_seconds = std::max(0.0, wall_seconds - stats[t].busy_seconds);
+    }
+
+    const std::vector<thread_stats>& thread_statistics() const { return stats; }
+
+    void report(std::ostream& out) const {
+        double max_busy = 0, min_busy = wall_seconds, total_idle = 0;
+        for (int t = 0; t < thread_count; ++t) {
+            const auto& s = stats[t];
+            out << "Thread " << t << ": busy " << s.busy_seconds << "s, idle " << s.idle_seconds
+                << "s, " << s.tiles << " tiles (" << s.stolen << " stolen)\n";
+            max_busy = std::max(max_busy, s.busy_seconds);
+            min_busy = std::min(min_busy, s.busy_seconds);
+            total_idle += s.idle_seconds;
+        }
+        out << "Tiles: " << tiles.size() << ", wall " << wall_seconds << "s, busy min/max "
+            << (max_busy > 0 ? min_busy / max_busy : 1.0) << ", idle "
+            << (wall_seconds > 0 ? 100.0 * total_idle / (wall_seconds * thread_count) : 0.0) << "%\n";
+    }
+
+private:
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<int> items;
+    };
+
+    int thread_count;
+    std::vector<tile> tiles;
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<thread_stats> stats;
+    double wall_seconds = 0;
+
+    bool next_tile(int id, int& index, bool& stolen) {
+        {
+            std::lock_guard<std::mutex> guard(queues[id]->lock);
+            if (!queues[id]->items.empty()) {
+                index = queues[id]->items.front();
+                queues[id]->items.pop_front();
+                stolen = false;
+                return true;
+            }
+        }
+        for (int k = 1; k < thread_count; ++k) {
+            worker_queue& victim = *queues[(id + k) % thread_count];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.items.empty()) {
+                index = victim.items.back();
+                victim.items.pop_back();
+                stolen = true;
+                return true;
+            }
+        }
+        return false;
+    }
+};
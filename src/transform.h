@@ -0,0 +1,97 @@
+#pragma once
+#include "vec3.h"
+#include "rtweekend.h"
+#include <cmath>
+
+// A 3x4 affine transform: a 3x3 linear part (rotation, scale, shear) in the
+// first three columns and a translation in the last.
+class affine_transform {
+public:
+    double m[3][4];
+
+    affine_transform() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+    static affine_transform translation(const vec3& offset) {
+        affine_transform t;
+        for (int r = 0; r < 3; ++r) t.m[r][3] = offset[r];
+        return t;
+    }
+
+    static affine_transform scaling(const vec3& s) {
+        affine_transform t;
+        for (int r = 0; r < 3; ++r) t.m[r][r] = s[r];
+        return t;
+    }
+
+    // Rotation by angle degrees about axis (right-handed).
+    static affine_transform rotation(const vec3& axis, double degrees) {
+        vec3 a = unit_vector(axis);
+        double theta = degrees_to_radians(degrees);
+        double c = std::cos(theta), s = std::sin(theta), k = 1.0 - c;
+        affine_transform t;
+        t.m[0][0] = c + a.x() * a.x() * k;
+        t.m[0][1] = a.x() * a.y() * k - a.z() * s;
+        t.m[0][2] = a.x() * a.z() * k + a.y() * s;
+        t.m[1][0] = a.y() * a.x() * k + a.z() * s;
+        t.m[1][1] = c + a.y() * a.y() * k;
+        t.m[1][2] = a.y() * a.z() * k - a.x() * s;
+        t.m[2][0] = a.z() * a.x() * k - a.y() * s;
+        t.m[2][1] = a.z() * a.y() * k + a.x() * s;
+        t.m[2][2] = c + a.z() * a.z() * k;
+        return t;
+    }
+
+    point3 apply_point(const point3& p) const {
+        return point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                      m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                      m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // Multiplies by the transpose of the linear part; applied on the inverse
+    // transform this maps object-space normals to world space.
+    vec3 apply_transposed(const vec3& v) const {
+        return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                    m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                    m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    affine_transform inverse() const {
+        double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                   - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                   + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        double inv_det = 1.0 / det;
+
+        affine_transform inv;
+        inv.m[0][0] =  (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+        inv.m[0][1] = -(m[0][1] * m[2][2] - m[0][2] * m[2][1]) * inv_det;
+        inv.m[0][2] =  (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        inv.m[1][0] = -(m[1][0] * m[2][2] - m[1][2] * m[2][0]) * inv_det;
+        inv.m[1][1] =  (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        inv.m[1][2] = -(m[0][0] * m[1][2] - m[0][2] * m[1][0]) * inv_det;
+        inv.m[2][0] =  (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+        inv.m[2][1] = -(m[0][0] * m[2][1] - m[0][1] * m[2][0]) * inv_det;
+        inv.m[2][2] =  (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        vec3 t = inv.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int r = 0; r < 3; ++r) inv.m[r][3] = -t[r];
+        return inv;
+    }
+};
+
+// a * b applies b first, then a.
+inline affine_transform operator*(const affine_transform& a, const affine_transform& b) {
+    affine_transform out;
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            out.m[r][c] = a.m[r][0] * b.m[0][c] + a.m[r][1] * b.m[1][c] + a.m[r][2] * b.m[2][c]
+                        + (c == 3 ? a.m[r][3] : 0.0);
+        }
+    }
+    return out;
+}
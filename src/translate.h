@@ -13,9 +13,20 @@ public:
 
         rec.p += offset;
         rec.set_face_normal(moved_r, rec.normal);
+        rec.object = this;
         return true;
     }
 
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        return ptr->occluded(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        return ptr->transmittance(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+    }
+
+    virtual bool has_media() const override { return ptr->has_media(); }
+
     virtual bool bounding_box(aabb& output_box) const override {
         if (!ptr->bounding_box(output_box))
             return false;
@@ -2,6 +2,23 @@
 #include "hittable.h"
 #include "vec3.h"
 #include "vec2.h"
+#include "rtweekend.h"
+
+// Derivatives in (u, v) of a vector attribute interpolated linearly over a
+// triangle with texture coordinates uv0..uv2; zero if those are degenerate.
+inline void uv_derivatives(const vec3& a0, const vec3& a1, const vec3& a2,
+                           const vec2& uv0, const vec2& uv1, const vec2& uv2,
+                           vec3& d_du, vec3& d_dv) {
+    const vec2 duv02 = uv0 - uv2, duv12 = uv1 - uv2;
+    const double det = duv02.x() * duv12.y() - duv02.y() * duv12.x();
+    if (std::fabs(det) < 1e-12) {
+        d_du = d_dv = vec3(0, 0, 0);
+        return;
+    }
+    const vec3 da02 = a0 - a2, da12 = a1 - a2;
+    d_du = (duv12.y() * da02 - duv02.y() * da12) / det;
+    d_dv = (duv02.x() * da12 - duv12.x() * da02) / det;
+}
 
 class triangle : public hittable {
 public:
@@ -10,7 +27,7 @@ public:
     triangle(const point3& a, const point3& b, const point3& c,
              const vec2& ta, const vec2& tb, const vec2& tc,
              const vec3& na, const vec3& nb, const vec3& nc,
-             std::shared_ptr<material> m)
+             const material* m)
         : v0(a), v1(b), v2(c), 
           uv0(ta), uv1(tb), uv2(tc),
           n0(na), n1(nb), n2(nc), 
@@ -19,39 +36,25 @@ public:
 
     triangle(const point3& a, const point3& b, const point3& c,
              const vec2& ta, const vec2& tb, const vec2& tc,
-             std::shared_ptr<material> m)
+             const material* m)
         : v0(a), v1(b), v2(c),
           uv0(ta), uv1(tb), uv2(tc),
           has_normals(false), 
           mat_ptr(m) {}
 
     triangle(const point3& a, const point3& b, const point3& c,
-             std::shared_ptr<material> m)
+             const material* m)
         : v0(a), v1(b), v2(c),
           uv0(vec2(0,0)), uv1(vec2(1,0)), uv2(vec2(0,1)),
           has_normals(false),
           mat_ptr(m) {}
 
     bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
-        const double eps = 1e-8;
+        double t_hit, u, v;
+        if (!intersect(r, t_min, t_max, t_hit, u, v)) return false;
+
         vec3 e1 = v1 - v0;
         vec3 e2 = v2 - v0;
-        vec3 p = cross(r.direction(), e2);
-        double det = dot(e1, p);
-        if (fabs(det) < eps) return false;
-        double invDet = 1.0 / det;
-
-        vec3 t = r.origin() - v0;
-        double u = dot(t, p) * invDet;
-        if (u < 0.0 || u > 1.0) return false;
-
-        vec3 q = cross(t, e1);
-        double v = dot(r.direction(), q) * invDet;
-        if (v < 0.0 || u + v > 1.0) return false;
-
-        double t_hit = dot(e2, q) * invDet;
-        if (t_hit < t_min || t_hit > t_max) return false;
-
         rec.t = t_hit;
         rec.p = r.at(t_hit);
         
@@ -64,11 +67,22 @@ public:
         
         rec.set_face_normal(r, normal);
         rec.mat_ptr = mat_ptr;
+        rec.object = this;
         rec.u = uv0.x() * (1 - u - v) + uv1.x() * u + uv2.x() * v;
         rec.v = uv0.y() * (1 - u - v) + uv1.y() * u + uv2.y() * v;
+        uv_derivatives(v0, v1, v2, uv0, uv1, uv2, rec.dpdu, rec.dpdv);
+        if (has_normals)
+            uv_derivatives(n0, n1, n2, uv0, uv1, uv2, rec.dndu, rec.dndv);
+        else
+            rec.dndu = rec.dndv = vec3(0, 0, 0);
         return true;
     }
 
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        double t_hit, u, v;
+        return intersect(r, t_min, t_max, t_hit, u, v);
+    }
+
     virtual bool bounding_box(aabb& output_box) const override {
         const double epsilon = 0.0001;
         
@@ -86,10 +100,60 @@ public:
         return true;
     }     
 
+    virtual double pdf_value(const point3& origin, const vec3& direction) const override {
+        double t, u, v;
+        if (!intersect(ray(origin, direction), 0.001, infinity, t, u, v))
+            return 0.0;
+        vec3 n = cross(v1 - v0, v2 - v0);
+        double dist_sq = t * t * direction.length_squared();
+        double cosine = std::fabs(dot(n, direction)) / (n.length() * direction.length());
+        return dist_sq / (cosine * area());
+    }
+
+    // Uniform over the triangle's area.
+    virtual vec3 random(const point3& origin, const vec2& u) const override {
+        double s = std::sqrt(u.x());
+        point3 p = (1.0 - s) * v0 + s * (1.0 - u.y()) * v1 + s * u.y() * v2;
+        return p - origin;
+    }
+
+    virtual const material* surface_material() const override { return mat_ptr; }
+    virtual double area() const override { return 0.5 * cross(v1 - v0, v2 - v0).length(); }
+
+    // Shading normals may face either way, so only flat triangles are bounded.
+    virtual bool normal_bounds(vec3& axis, double& cos_theta) const override {
+        if (has_normals)
+            return false;
+        axis = unit_vector(cross(v1 - v0, v2 - v0));
+        cos_theta = 1;
+        return true;
+    }
+
 private:
+    bool intersect(const ray& r, double t_min, double t_max, double& t_hit, double& u, double& v) const {
+        const double eps = 1e-8;
+        vec3 e1 = v1 - v0;
+        vec3 e2 = v2 - v0;
+        vec3 p = cross(r.direction(), e2);
+        double det = dot(e1, p);
+        if (fabs(det) < eps) return false;
+        double invDet = 1.0 / det;
+
+        vec3 t = r.origin() - v0;
+        u = dot(t, p) * invDet;
+        if (u < 0.0 || u > 1.0) return false;
+
+        vec3 q = cross(t, e1);
+        v = dot(r.direction(), q) * invDet;
+        if (v < 0.0 || u + v > 1.0) return false;
+
+        t_hit = dot(e2, q) * invDet;
+        return t_hit >= t_min && t_hit <= t_max;
+    }
+
     point3 v0, v1, v2;
     vec2 uv0, uv1, uv2;
     vec3 n0, n1, n2; 
     bool has_normals; 
-    std::shared_ptr<material> mat_ptr;
+    const material* mat_ptr;
 };
\ No newline at end of file
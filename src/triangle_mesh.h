@@ -0,0 +1,250 @@
+#pragma once
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "triangle.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Vertex attributes in structure-of-arrays form plus a 32-bit index buffer
+// (three indices per triangle). Normals and texcoords are optional; leave
+// them empty when the source has none.
+struct mesh_buffers {
+    std::vector<float> px, py, pz;
+    std::vector<float> nx, ny, nz;
+    std::vector<float> u, v;
+    std::vector<uint32_t> indices;
+};
+
+// Read-only views of a built mesh: the vertex attributes (normal and
+// texcoord pointers are null when absent), the index buffer in BVH leaf
+// order and the flattened BVH.
+struct mesh_arrays {
+    const float* px = nullptr;
+    const float* py = nullptr;
+    const float* pz = nullptr;
+    const float* nx = nullptr;
+    const float* ny = nullptr;
+    const float* nz = nullptr;
+    const float* u = nullptr;
+    const float* v = nullptr;
+    const uint32_t* indices = nullptr;
+    const linear_bvh_node* nodes = nullptr;
+    size_t vertex_count = 0;
+    size_t triangle_count = 0;
+    size_t node_count = 0;
+};
+
+// A whole triangle mesh as one hittable. Vertices are shared between faces
+// and an internal flattened BVH over the triangles replaces one heap object
+// per face. The index buffer is reordered to match the BVH's leaf order, so
+// leaves address triangles directly.
+//
+// A mesh built earlier can also be wrapped without copying (see
+// mesh_cache.h); owner then keeps the memory behind the arrays alive.
+class triangle_mesh : public hittable {
+public:
+    triangle_mesh(mesh_buffers buffers, const material* m,
+                  const bvh_build_options& options = bvh_build_options())
+        : mesh(std::move(buffers)), mat_ptr(m) {
+        const size_t tri_count = mesh.indices.size() / 3;
+        mesh.indices.resize(tri_count * 3);
+        point_at_buffers();
+
+        std::vector<bvh_primitive> prims(tri_count);
+        #pragma omp parallel for schedule(static) if(tri_count >= bvh_parallel_threshold)
+        for (size_t t = 0; t < tri_count; ++t) {
+            aabb tri_box = triangle_bounds(static_cast<uint32_t>(t));
+            prims[t] = {tri_box, tri_box.centroid(), t};
+        }
+
+        if (prims.empty())
+            return;
+
+        build_linear_bvh(prims, 0, prims.size(), options, nodes);
+        box = primitive_bounds(prims, 0, prims.size());
+
+        std::vector<uint32_t> ordered(mesh.indices.size());
+        for (size_t i = 0; i < prims.size(); ++i)
+            for (int k = 0; k < 3; ++k)
+                ordered[3 * i + k] = mesh.indices[3 * prims[i].index + k];
+        mesh.indices.swap(ordered);
+        point_at_buffers();
+    }
+
+    triangle_mesh(const mesh_arrays& arrays, const aabb& bounds, std::shared_ptr<const void> owner,
+                  const material* m)
+        : storage(std::move(owner)), data(arrays), mat_ptr(m), box(bounds) {}
+
+    triangle_mesh(const triangle_mesh&) = delete;
+    triangle_mesh& operator=(const triangle_mesh&) = delete;
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        if (data.node_count == 0)
+            return false;
+
+        uint32_t hit_tri = 0;
+        double hit_t = t_max, hit_b1 = 0, hit_b2 = 0;
+
+        bool found = traverse_linear_bvh(data.nodes, r, t_min, t_max,
+            [&](uint32_t first, uint32_t count, double& closest) {
+                bool hit_anything = false;
+                for (uint32_t tri = first; tri < first + count; ++tri) {
+                    double t, b1, b2;
+                    if (intersect(tri, r, t_min, closest, t, b1, b2)) {
+                        hit_anything = true;
+                        closest = hit_t = t;
+                        hit_tri = tri;
+                        hit_b1 = b1;
+                        hit_b2 = b2;
+                    }
+                }
+                return hit_anything;
+            });
+
+        if (!found)
+            return false;
+
+        const uint32_t i0 = data.indices[3 * hit_tri];
+        const uint32_t i1 = data.indices[3 * hit_tri + 1];
+        const uint32_t i2 = data.indices[3 * hit_tri + 2];
+        const double b0 = 1.0 - hit_b1 - hit_b2;
+
+        rec.t = hit_t;
+        rec.p = r.at(hit_t);
+
+        vec3 normal;
+        if (has_normals()) {
+            normal = unit_vector(b0 * vertex_normal(i0) + hit_b1 * vertex_normal(i1) + hit_b2 * vertex_normal(i2));
+        } else {
+            point3 p0 = position(i0);
+            normal = unit_vector(cross(position(i1) - p0, position(i2) - p0));
+        }
+        rec.set_face_normal(r, normal);
+        rec.mat_ptr = mat_ptr;
+        rec.object = this;
+
+        vec2 uv0(0, 0), uv1(1, 0), uv2(0, 1);
+        if (has_uvs()) {
+            uv0 = vertex_uv(i0);
+            uv1 = vertex_uv(i1);
+            uv2 = vertex_uv(i2);
+        }
+        rec.u = b0 * uv0.x() + hit_b1 * uv1.x() + hit_b2 * uv2.x();
+        rec.v = b0 * uv0.y() + hit_b1 * uv1.y() + hit_b2 * uv2.y();
+        uv_derivatives(position(i0), position(i1), position(i2), uv0, uv1, uv2, rec.dpdu, rec.dpdv);
+        if (has_normals())
+            uv_derivatives(vertex_normal(i0), vertex_normal(i1), vertex_normal(i2), uv0, uv1, uv2, rec.dndu, rec.dndv);
+        else
+            rec.dndu = rec.dndv = vec3(0, 0, 0);
+        return true;
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        if (data.node_count == 0)
+            return false;
+
+        return traverse_linear_bvh<true>(data.nodes, r, t_min, t_max,
+            [&](uint32_t first, uint32_t count, double& closest) {
+                for (uint32_t tri = first; tri < first + count; ++tri) {
+                    double t, b1, b2;
+                    if (intersect(tri, r, t_min, closest, t, b1, b2))
+                        return true;
+                }
+                return false;
+            });
+    }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        if (data.node_count == 0) return false;
+        output_box = box;
+        return true;
+    }
+
+    size_t triangle_count() const { return data.triangle_count; }
+    size_t vertex_count() const { return data.vertex_count; }
+    const mesh_arrays& arrays() const { return data; }
+
+    // Counts wrapped (e.g. memory-mapped) arrays as well as owned ones.
+    size_t memory_bytes() const {
+        return sizeof(*this)
+             + sizeof(float) * data.vertex_count * (3 + (has_normals() ? 3 : 0) + (has_uvs() ? 2 : 0))
+             + sizeof(uint32_t) * data.triangle_count * 3
+             + sizeof(linear_bvh_node) * data.node_count;
+    }
+
+private:
+    mesh_buffers mesh;
+    std::vector<linear_bvh_node> nodes;
+    std::shared_ptr<const void> storage;
+    mesh_arrays data;
+    const material* mat_ptr;
+    aabb box;
+
+    template <typename T>
+    static const T* pointer_to(const std::vector<T>& values) {
+        return values.empty() ? nullptr : values.data();
+    }
+
+    void point_at_buffers() {
+        data.px = pointer_to(mesh.px);
+        data.py = pointer_to(mesh.py);
+        data.pz = pointer_to(mesh.pz);
+        data.nx = pointer_to(mesh.nx);
+        data.ny = pointer_to(mesh.ny);
+        data.nz = pointer_to(mesh.nz);
+        data.u = pointer_to(mesh.u);
+        data.v = pointer_to(mesh.v);
+        data.indices = pointer_to(mesh.indices);
+        data.nodes = pointer_to(nodes);
+        data.vertex_count = mesh.px.size();
+        data.triangle_count = mesh.indices.size() / 3;
+        data.node_count = nodes.size();
+    }
+
+    bool has_normals() const { return data.nx != nullptr; }
+    bool has_uvs() const { return data.u != nullptr; }
+
+    point3 position(uint32_t i) const { return point3(data.px[i], data.py[i], data.pz[i]); }
+    vec3 vertex_normal(uint32_t i) const { return vec3(data.nx[i], data.ny[i], data.nz[i]); }
+    vec2 vertex_uv(uint32_t i) const { return vec2(data.u[i], data.v[i]); }
+
+    aabb triangle_bounds(uint32_t tri) const {
+        const double epsilon = 0.0001;
+        point3 a = position(mesh.indices[3 * tri]);
+        point3 b = position(mesh.indices[3 * tri + 1]);
+        point3 c = position(mesh.indices[3 * tri + 2]);
+        point3 min_pt(fmin(fmin(a.x(), b.x()), c.x()) - epsilon,
+                      fmin(fmin(a.y(), b.y()), c.y()) - epsilon,
+                      fmin(fmin(a.z(), b.z()), c.z()) - epsilon);
+        point3 max_pt(fmax(fmax(a.x(), b.x()), c.x()) + epsilon,
+                      fmax(fmax(a.y(), b.y()), c.y()) + epsilon,
+                      fmax(fmax(a.z(), b.z()), c.z()) + epsilon);
+        return aabb(min_pt, max_pt);
+    }
+
+    // Moller-Trumbore, matching triangle::hit.
+    bool intersect(uint32_t tri, const ray& r, double t_min, double t_max,
+                   double& t_hit, double& u, double& v) const {
+        const double eps = 1e-8;
+        point3 v0 = position(data.indices[3 * tri]);
+        vec3 e1 = position(data.indices[3 * tri + 1]) - v0;
+        vec3 e2 = position(data.indices[3 * tri + 2]) - v0;
+        vec3 p = cross(r.direction(), e2);
+        double det = dot(e1, p);
+        if (fabs(det) < eps) return false;
+        double inv_det = 1.0 / det;
+
+        vec3 t = r.origin() - v0;
+        u = dot(t, p) * inv_det;
+        if (u < 0.0 || u > 1.0) return false;
+
+        vec3 q = cross(t, e1);
+        v = dot(r.direction(), q) * inv_det;
+        if (v < 0.0 || u + v > 1.0) return false;
+
+        t_hit = dot(e2, q) * inv_det;
+        return t_hit >= t_min && t_hit <= t_max;
+    }
+};
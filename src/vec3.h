@@ -79,4 +79,11 @@ inline bool refract(const vec3& uv, const vec3& n, double etai_over_etat, vec3&
     vec3 r_out_parallel = -std::sqrt(k) * n;
     refracted = r_out_perp + r_out_parallel;
     return true;
-}
\ No newline at end of file
+}
+
+// Completes unit vector w to an orthonormal basis (u, v, w).
+inline void onb_from_w(const vec3& w, vec3& u, vec3& v) {
+    vec3 a = (fabs(w.x()) > 0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+    v = unit_vector(cross(w, a));
+    u = cross(w, v);
+}
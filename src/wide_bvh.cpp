@@ -0,0 +1,326 @@
+#include "wide_bvh.h"
+#include "cpu_features.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+
+#if defined(RT_X86)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const int wide_bvh_max_depth = 32;
+// Leaves count their primitives in 16 bits; subtrees too large for one leaf
+// at the depth limit go on into spare levels, as in linear_bvh.
+const size_t wide_bvh_max_leaf_size = 65535;
+const int wide_bvh_stack_depth = wide_bvh_max_depth + 17;
+const int wide_bvh_stack_size = wide_bvh_stack_depth * 7 + 1;
+
+// Widens the exit distance slightly so float rounding never culls a box the
+// ray actually grazes.
+const float slab_far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+simd_ray make_simd_ray(const ray& r, double t_min) {
+    simd_ray sr;
+    for (int a = 0; a < 3; ++a) {
+        double d = r.direction()[a];
+        if (std::fabs(d) < 1e-30)
+            d = d < 0.0 ? -1e-30 : 1e-30;
+        sr.org[a] = static_cast<float>(r.origin()[a]);
+        sr.inv_dir[a] = static_cast<float>(1.0 / d);
+    }
+    sr.t_min = static_cast<float>(t_min);
+    return sr;
+}
+
+template <int W>
+int slab_test_scalar(const wide_bvh_node<W>& n, const simd_ray& r, float t_max, float* t_entry) {
+    int mask = 0;
+    for (int i = 0; i < W; ++i) {
+        float t0x = (n.min_x[i] - r.org[0]) * r.inv_dir[0];
+        float t1x = (n.max_x[i] - r.org[0]) * r.inv_dir[0];
+        float t0y = (n.min_y[i] - r.org[1]) * r.inv_dir[1];
+        float t1y = (n.max_y[i] - r.org[1]) * r.inv_dir[1];
+        float t0z = (n.min_z[i] - r.org[2]) * r.inv_dir[2];
+        float t1z = (n.max_z[i] - r.org[2]) * r.inv_dir[2];
+
+        float t_near = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)),
+                                std::max(std::min(t0z, t1z), r.t_min));
+        float t_far = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)),
+                               std::min(std::max(t0z, t1z), t_max));
+
+        t_entry[i] = t_near;
+        if (t_near <= t_far * slab_far_scale)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(RT_X86)
+int slab_test_sse(const wide_bvh_node<4>& n, const simd_ray& r, float t_max, float* t_entry) {
+    const __m128 ox = _mm_set1_ps(r.org[0]);
+    const __m128 oy = _mm_set1_ps(r.org[1]);
+    const __m128 oz = _mm_set1_ps(r.org[2]);
+    const __m128 ix = _mm_set1_ps(r.inv_dir[0]);
+    const __m128 iy = _mm_set1_ps(r.inv_dir[1]);
+    const __m128 iz = _mm_set1_ps(r.inv_dir[2]);
+
+    __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.min_x), ox), ix);
+    __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.max_x), ox), ix);
+    __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.min_y), oy), iy);
+    __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.max_y), oy), iy);
+    __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.min_z), oz), iz);
+    __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.max_z), oz), iz);
+
+    __m128 t_near = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                               _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(r.t_min)));
+    __m128 t_far = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                              _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(t_max)));
+    t_far = _mm_mul_ps(t_far, _mm_set1_ps(slab_far_scale));
+
+    _mm_storeu_ps(t_entry, t_near);
+    return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+}
+
+RT_TARGET_AVX2
+int slab_test_avx2(const wide_bvh_node<8>& n, const simd_ray& r, float t_max, float* t_entry) {
+    const __m256 ox = _mm256_set1_ps(r.org[0]);
+    const __m256 oy = _mm256_set1_ps(r.org[1]);
+    const __m256 oz = _mm256_set1_ps(r.org[2]);
+    const __m256 ix = _mm256_set1_ps(r.inv_dir[0]);
+    const __m256 iy = _mm256_set1_ps(r.inv_dir[1]);
+    const __m256 iz = _mm256_set1_ps(r.inv_dir[2]);
+
+    __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.min_x), ox), ix);
+    __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.max_x), ox), ix);
+    __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.min_y), oy), iy);
+    __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.max_y), oy), iy);
+    __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.min_z), oz), iz);
+    __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n.max_z), oz), iz);
+
+    __m256 t_near = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+                                  _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_set1_ps(r.t_min)));
+    __m256 t_far = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+                                 _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(t_max)));
+    t_far = _mm256_mul_ps(t_far, _mm256_set1_ps(slab_far_scale));
+
+    _mm256_storeu_ps(t_entry, t_near);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+}
+#endif
+
+struct scalar_slab {
+    template <int W>
+    int operator()(const wide_bvh_node<W>& n, const simd_ray& r, float t_max, float* t_entry) const {
+        return slab_test_scalar(n, r, t_max, t_entry);
+    }
+};
+
+#if defined(RT_X86)
+struct sse_slab {
+    int operator()(const wide_bvh_node<4>& n, const simd_ray& r, float t_max, float* t_entry) const {
+        return slab_test_sse(n, r, t_max, t_entry);
+    }
+};
+
+struct avx2_slab {
+    int operator()(const wide_bvh_node<8>& n, const simd_ray& r, float t_max, float* t_entry) const {
+        return slab_test_avx2(n, r, t_max, t_entry);
+    }
+};
+#endif
+
+template <int W>
+wide_bvh_node<W> empty_wide_node() {
+    wide_bvh_node<W> n;
+    for (int i = 0; i < W; ++i) {
+        n.min_x[i] = n.min_y[i] = n.min_z[i] = std::numeric_limits<float>::infinity();
+        n.max_x[i] = n.max_y[i] = n.max_z[i] = -std::numeric_limits<float>::infinity();
+        n.child[i] = 0;
+        n.count[i] = 0;
+    }
+    n.num_children = 0;
+    return n;
+}
+
+}
+
+wide_bvh::wide_bvh(const bvh_node& root, int width, bool use_simd) {
+    const bool avx2 = use_simd && cpu_has_avx2();
+    node_width = width == 0 ? (avx2 ? 8 : 4) : (width == 8 ? 8 : 4);
+
+    if (node_width == 8)
+        slab_kernel = avx2 ? simd_kernel::avx2 : simd_kernel::scalar;
+    else
+        slab_kernel = use_simd && cpu_has_sse() ? simd_kernel::sse : simd_kernel::scalar;
+
+    if (root.is_leaf() && root.objects.empty())
+        return;
+
+    box = root.box;
+    if (node_width == 8)
+        collapse<8>(root, nodes8, 0);
+    else
+        collapse<4>(root, nodes4, 0);
+}
+
+const char* wide_bvh::kernel_name() const {
+    switch (slab_kernel) {
+        case simd_kernel::avx2: return "avx2";
+        case simd_kernel::sse: return "sse";
+        default: return "scalar";
+    }
+}
+
+void wide_bvh::collect(const bvh_node& node) {
+    if (node.is_leaf()) {
+        for (const auto& object : node.objects) {
+            owned.push_back(object);
+            primitives.push_back(object.get());
+            if (object->has_media())
+                media.push_back(object.get());
+        }
+        return;
+    }
+    collect(*node.left);
+    collect(*node.right);
+}
+
+// Turns a binary subtree into one W-wide node by repeatedly opening the
+// interior child with the largest surface area until W children remain.
+template <int W>
+uint32_t wide_bvh::collapse(const bvh_node& node, std::vector<wide_bvh_node<W>>& nodes, int depth) {
+    if (depth >= wide_bvh_stack_depth) {
+        std::cerr << "wide_bvh: a subtree of " << node.primitive_count() << " primitives is too deep to collapse\n";
+        std::abort();
+    }
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    std::vector<const bvh_node*> kids;
+    if (node.is_leaf()) {
+        kids.push_back(&node);
+    } else {
+        kids.push_back(node.left.get());
+        kids.push_back(node.right.get());
+    }
+
+    while (kids.size() < static_cast<size_t>(W)) {
+        int best = -1;
+        double best_area = -1.0;
+        for (size_t i = 0; i < kids.size(); ++i) {
+            if (kids[i]->is_leaf()) continue;
+            double area = kids[i]->box.surface_area();
+            if (area > best_area) {
+                best_area = area;
+                best = static_cast<int>(i);
+            }
+        }
+        if (best < 0) break;
+
+        const bvh_node* opened = kids[best];
+        kids[best] = opened->left.get();
+        kids.push_back(opened->right.get());
+    }
+
+    wide_bvh_node<W> wn = empty_wide_node<W>();
+    wn.num_children = static_cast<uint32_t>(kids.size());
+
+    for (size_t i = 0; i < kids.size(); ++i) {
+        const aabb& b = kids[i]->box;
+        wn.min_x[i] = round_down(b.min().x());
+        wn.min_y[i] = round_down(b.min().y());
+        wn.min_z[i] = round_down(b.min().z());
+        wn.max_x[i] = round_up(b.max().x());
+        wn.max_y[i] = round_up(b.max().y());
+        wn.max_z[i] = round_up(b.max().z());
+
+        if (kids[i]->is_leaf() || (depth >= wide_bvh_max_depth - 1
+                                   && kids[i]->primitive_count() <= wide_bvh_max_leaf_size)) {
+            size_t first = primitives.size();
+            collect(*kids[i]);
+            wn.child[i] = static_cast<uint32_t>(first);
+            wn.count[i] = static_cast<uint16_t>(primitives.size() - first);
+        } else {
+            wn.child[i] = collapse<W>(*kids[i], nodes, depth + 1);
+            wn.count[i] = 0;
+        }
+    }
+
+    nodes[index] = wn;
+    return index;
+}
+
+template <int W, typename Kernel>
+bool wide_bvh::traverse(const std::vector<wide_bvh_node<W>>& nodes, Kernel slab_test,
+                        const ray& r, double t_min, double t_max, hit_record* rec) const {
+    struct stack_entry {
+        uint32_t child;
+        uint32_t count;
+        float t;
+    };
+
+    const simd_ray sr = make_simd_ray(r, t_min);
+    stack_entry stack[wide_bvh_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, sr.t_min};
+
+    alignas(32) float t_entry[W];
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        const stack_entry e = stack[--stack_size];
+        if (e.t > t_max * slab_far_scale)
+            continue;
+
+        if (e.count > 0) {
+            for (uint32_t i = e.child; i < e.child + e.count; ++i) {
+                if (!rec) {
+                    if (primitives[i]->occluded(r, t_min, t_max))
+                        return true;
+                } else if (primitives[i]->hit(r, t_min, t_max, *rec)) {
+                    hit_anything = true;
+                    t_max = rec->t;
+                }
+            }
+            continue;
+        }
+
+        const wide_bvh_node<W>& node = nodes[e.child];
+        int mask = slab_test(node, sr, static_cast<float>(t_max), t_entry);
+        mask &= (1 << node.num_children) - 1;
+
+        // Keep the children just pushed sorted so the nearest is on top.
+        const int first = stack_size;
+        for (int i = 0; i < W; ++i) {
+            if (!(mask & (1 << i))) continue;
+            stack_entry entry = {node.child[i], node.count[i], t_entry[i]};
+            int j = stack_size++;
+            while (j > first && stack[j - 1].t < entry.t) {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = entry;
+        }
+    }
+
+    return hit_anything;
+}
+
+bool wide_bvh::intersect(const ray& r, double t_min, double t_max, hit_record* rec) const {
+    if (primitives.empty())
+        return false;
+
+#if defined(RT_X86)
+    if (slab_kernel == simd_kernel::avx2)
+        return traverse(nodes8, avx2_slab(), r, t_min, t_max, rec);
+    if (slab_kernel == simd_kernel::sse)
+        return traverse(nodes4, sse_slab(), r, t_min, t_max, rec);
+#endif
+    if (node_width == 8)
+        return traverse(nodes8, scalar_slab(), r, t_min, t_max, rec);
+    return traverse(nodes4, scalar_slab(), r, t_min, t_max, rec);
+}
@@ -0,0 +1,90 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "hittable.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "cpu_features.h"
+#include <cstdint>
+#include <vector>
+
+// A node of an N-wide BVH. Child boxes are kept in structure-of-arrays form
+// so one SIMD slab test covers every child at once. A child with a non-zero
+// count is a leaf referencing a primitive range; otherwise child[i] is the
+// index of another node.
+template <int W>
+struct alignas(32) wide_bvh_node {
+    float min_x[W], min_y[W], min_z[W];
+    float max_x[W], max_y[W], max_z[W];
+    uint32_t child[W];
+    uint16_t count[W];
+    uint32_t num_children;
+};
+
+// Per-ray data shared by every slab test of a traversal.
+struct simd_ray {
+    float org[3];
+    float inv_dir[3];
+    float t_min;
+};
+
+class wide_bvh : public hittable {
+public:
+    // width 0 picks 8 when the CPU supports AVX2 and 4 otherwise. Without
+    // use_simd, or on CPUs lacking the instructions, slab tests run scalar.
+    wide_bvh(const bvh_node& root, int width = 0, bool use_simd = true);
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+        return intersect(r, t_min, t_max, &rec);
+    }
+
+    virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+        return intersect(r, t_min, t_max, nullptr);
+    }
+
+    virtual double transmittance(const ray& r, double t_min, double t_max) const override {
+        double result = 1.0;
+        for (const hittable* medium : media)
+            result *= medium->transmittance(r, t_min, t_max);
+        return result;
+    }
+
+    virtual bool has_media() const override { return !media.empty(); }
+
+    virtual bool bounding_box(aabb& output_box) const override {
+        if (primitives.empty()) return false;
+        output_box = box;
+        return true;
+    }
+
+    int width() const { return node_width; }
+    simd_kernel kernel() const { return slab_kernel; }
+    const char* kernel_name() const;
+    size_t node_count() const { return node_width == 8 ? nodes8.size() : nodes4.size(); }
+
+public:
+    std::vector<const hittable*> primitives;
+    aabb box;
+
+private:
+    int node_width;
+    simd_kernel slab_kernel;
+    std::vector<wide_bvh_node<4>> nodes4;
+    std::vector<wide_bvh_node<8>> nodes8;
+    std::vector<std::shared_ptr<hittable>> owned;
+    std::vector<const hittable*> media;   // few, so shadow rays test each directly
+
+    template <int W>
+    uint32_t collapse(const bvh_node& node, std::vector<wide_bvh_node<W>>& nodes, int depth);
+
+    void collect(const bvh_node& node);
+
+    // Closest hit into rec, or any hit at all when rec is null.
+    bool intersect(const ray& r, double t_min, double t_max, hit_record* rec) const;
+
+    template <int W, typename Kernel>
+    bool traverse(const std::vector<wide_bvh_node<W>>& nodes, Kernel slab_test,
+                  const ray& r, double t_min, double t_max, hit_record* rec) const;
+};
+
+#endif